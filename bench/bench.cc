@@ -0,0 +1,170 @@
+// Measures costs of supervision: spawn and restart latency, master memory per worker and check_workers CPU time.
+// Prints a single JSON object to stdout, logs (if enabled with -v) go to stderr.
+#include <panda/unievent/http/manager/Mpm.h>
+#include <panda/log.h>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <string>
+#include <unistd.h>
+
+using namespace panda;
+using namespace panda::unievent;
+using namespace panda::unievent::http::manager;
+
+static size_t rss_kb () {
+    #ifdef __linux__
+    auto fh = fopen("/proc/self/statm", "r");
+    if (!fh) return 0;
+    unsigned long size = 0, resident = 0;
+    auto n = fscanf(fh, "%lu %lu", &size, &resident);
+    fclose(fh);
+    if (n != 2) return 0;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+    #else
+    return 0;
+    #endif
+}
+
+struct ModelResult {
+    const char* model;
+    uint32_t    workers;
+    bool        ok             = false;
+    double      spawn_ms       = 0; // average from spawn() to running
+    double      restart_ms     = 0; // restart_workers() until no worker is left in restarting state
+    double      rss_per_worker = 0; // kB of master's resident memory per worker
+};
+
+static ModelResult bench_model (const char* name, Manager::WorkerModel model, uint32_t nworkers) {
+    ModelResult res;
+    res.model   = name;
+    res.workers = nworkers;
+
+    Manager::Config cfg;
+    cfg.server.locations = { {"127.0.0.1", 0} };
+    cfg.worker_model     = model;
+    cfg.min_servers      = nworkers;
+    cfg.max_servers      = nworkers;
+    cfg.min_worker_ttl   = 0;
+    cfg.check_interval   = 0.05;
+    cfg.notify_interval  = 1;
+
+    ManagerSP mgr = new Manager(cfg);
+    auto rss0 = rss_kb();
+
+    enum class Phase { spawning, restarting, done } phase = Phase::spawning;
+    uint64_t restart_start = 0;
+
+    mgr->stats_event.add([&](auto&) {
+        auto st = mgr->stats();
+        uint32_t running = 0, restarting = 0;
+        for (auto& w : st.workers) {
+            if (w.state == Manager::WorkerState::running)    ++running;
+            if (w.state == Manager::WorkerState::restarting) ++restarting;
+        }
+
+        if (phase == Phase::spawning && running == nworkers) {
+            res.spawn_ms       = st.counters.spawn_latency_count ? (double)st.counters.spawn_latency_sum / st.counters.spawn_latency_count : 0;
+            res.rss_per_worker = (double)(rss_kb() - rss0) / nworkers;
+            phase = Phase::restarting;
+            restart_start = monotonic_ms();
+            mgr->restart_workers();
+        }
+        else if (phase == Phase::restarting && st.counters.restarted >= nworkers && !restarting && running == nworkers) {
+            res.restart_ms = monotonic_ms() - restart_start;
+            res.ok = true;
+            phase = Phase::done;
+            mgr->stop();
+        }
+    });
+
+    auto timeout = Timer::create_once(30000, [&](auto&) {
+        fprintf(stderr, "%s: timed out\n", name);
+        mgr->stop();
+    }, mgr->loop());
+    timeout->weak(true);
+
+    mgr->run();
+    return res;
+}
+
+// supervision logic only: workers are fake, so the result is the pure cost of the master's bookkeeping
+struct FakeWorker : Worker {
+    void fetch_state () override { activity_time = monotonic_ms(); } // heartbeat, master promotes it to running
+    void terminate   () override {}
+    void kill        () override {}
+    void activate    () override {}
+};
+
+struct BenchMpm : Mpm {
+    using Mpm::Mpm;
+
+    WorkerPtr create_worker (const WorkerParams&) override { return std::make_unique<FakeWorker>(); }
+
+    void run () override {
+        loop->delay([this]{ loop->delay([this]{ loop->stop(); }); }); // just let the first check spawn min_servers
+        Mpm::run();
+    }
+
+    double check_cpu_us (uint32_t iterations) {
+        auto start = std::clock();
+        for (uint32_t i = 0; i < iterations; ++i) check_timer->call_now();
+        return (double)(std::clock() - start) * 1000000 / CLOCKS_PER_SEC / iterations;
+    }
+};
+
+struct CheckResult {
+    uint32_t workers;
+    double   cpu_us;
+};
+
+static CheckResult bench_check (uint32_t nworkers) {
+    Manager::Config cfg;
+    cfg.server.locations = { {"127.0.0.1", 0} };
+    cfg.min_servers      = nworkers;
+    cfg.max_servers      = nworkers;
+    auto loop = Loop::default_loop();
+    BenchMpm mpm(cfg, loop, loop);
+    mpm.run();
+    return {nworkers, mpm.check_cpu_us(nworkers >= 1024 ? 200 : 2000)};
+}
+
+int main (int argc, char** argv) {
+    uint32_t nworkers = 4;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-v")) {
+            panda::log::set_level(panda::log::Level::Debug, "UniEvent::HTTP::Manager");
+            panda::log::set_logger([](const string& msg, auto&) { fprintf(stderr, "%s\n", msg.c_str()); });
+        }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) nworkers = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [-v] [-n workers]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<ModelResult> models;
+    #ifndef _WIN32
+    models.push_back(bench_model("prefork", Manager::WorkerModel::PreFork, nworkers));
+    #endif
+    models.push_back(bench_model("thread", Manager::WorkerModel::Thread, nworkers));
+
+    std::vector<CheckResult> checks;
+    for (auto n : {1, 64, 1024}) checks.push_back(bench_check(n));
+
+    printf("{\n  \"models\": [\n");
+    for (size_t i = 0; i < models.size(); ++i) {
+        auto& m = models[i];
+        printf("    {\"model\": \"%s\", \"workers\": %u, \"ok\": %s, \"spawn_ms\": %.3f, \"restart_ms\": %.3f, \"master_rss_kb_per_worker\": %.1f}%s\n",
+               m.model, m.workers, m.ok ? "true" : "false", m.spawn_ms, m.restart_ms, m.rss_per_worker, i + 1 < models.size() ? "," : "");
+    }
+    printf("  ],\n  \"check_workers\": [\n");
+    for (size_t i = 0; i < checks.size(); ++i) {
+        printf("    {\"workers\": %u, \"cpu_us\": %.3f}%s\n", checks[i].workers, checks[i].cpu_us, i + 1 < checks.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+
+    for (auto& m : models) if (!m.ok) return 2;
+    return 0;
+}
@@ -0,0 +1,274 @@
+// End-to-end throughput: runs a Manager on 127.0.0.1 in a child process and drives it with keep-alive http clients.
+// Every combination of worker count, worker model, listening sockets mode and force_worker_stop is measured; results go to stdout
+// as a single JSON object. The load generator runs on the same host, so give it enough threads (-t) not to be the bottleneck.
+// With -a every request is made on a new connection, which measures accept throughput rather than request handling.
+#include <panda/unievent/http/manager/Mpm.h>
+#include <panda/unievent/http.h>
+#include <panda/unievent/util.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace panda;
+using namespace panda::unievent;
+using namespace panda::unievent::http;
+using namespace panda::unievent::http::manager;
+
+struct Options {
+    std::vector<uint32_t> workers;
+    uint32_t threads     = 2;   // load generator threads
+    uint32_t connections = 64;  // per generator thread
+    uint32_t duration    = 3;   // seconds per combination
+    bool     accept      = false; // connection per request
+};
+
+// shared: one socket bound by master, accept_mutex: shared with workers taking turns accepting (prefork only),
+// reuse_port: each worker binds its own, per_worker: master binds one per worker
+enum class Sockets { Shared, AcceptMutex, ReusePort, PerWorker };
+
+static const char* sockets_name (Sockets sockets) {
+    switch (sockets) {
+        case Sockets::Shared      : return "shared";
+        case Sockets::AcceptMutex : return "accept_mutex";
+        case Sockets::ReusePort   : return "reuse_port";
+        case Sockets::PerWorker   : return "per_worker";
+    }
+    return "";
+}
+
+struct Scenario {
+    const char*          model_name;
+    Manager::WorkerModel model;
+    uint32_t             workers;
+    Sockets              sockets;
+    bool                 force_worker_stop;
+};
+
+struct Result {
+    bool      ok       = false;
+    uint64_t  requests = 0;
+    uint64_t  errors   = 0;
+    double    rps      = 0;
+    Histogram latency;
+};
+
+static uint16_t free_port () {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || getsockname(fd, (sockaddr*)&addr, &len) != 0) {
+        perror("bind");
+        exit(1);
+    }
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+// child process: master of the manager, reports readiness through the pipe once all workers are running
+[[noreturn]] static void run_manager (const Scenario& sc, uint16_t port, int ready_fd) {
+    Manager::Config cfg;
+    Server::Location loc;
+    loc.host       = "127.0.0.1";
+    loc.port       = port;
+    loc.reuse_port = sc.sockets == Sockets::ReusePort || sc.sockets == Sockets::PerWorker;
+    cfg.server.locations   = {loc};
+    cfg.worker_model       = sc.model;
+    cfg.min_servers        = sc.workers;
+    cfg.max_servers        = sc.workers;
+    cfg.force_worker_stop  = sc.force_worker_stop;
+    cfg.per_worker_sockets = sc.sockets == Sockets::PerWorker;
+    cfg.accept_mutex       = sc.sockets == Sockets::AcceptMutex;
+
+    ManagerSP mgr = new Manager(cfg);
+    mgr->request_event.add([](auto& req) {
+        req->respond(new ServerResponse(200, Headers().add("Content-Type", "text/plain"), Body("ok")));
+    });
+
+    bool reported = false;
+    mgr->stats_event.add([&](auto&) {
+        if (reported) return;
+        uint32_t running = 0;
+        for (auto& w : mgr->stats().workers) if (w.state == Manager::WorkerState::running) ++running;
+        if (running < sc.workers) return;
+        reported = true;
+        char c = 1;
+        if (write(ready_fd, &c, 1) != 1) perror("write");
+        close(ready_fd);
+    });
+
+    auto term = Signal::create(SIGTERM, [&](auto...) { mgr->stop(); }, mgr->loop());
+    term->weak(true);
+
+    mgr->run();
+    _exit(0);
+}
+
+struct Generator {
+    LoopSP    loop = new Loop();
+    PoolSP    pool;
+    string    uri;
+    bool      accept;
+    uint64_t  deadline;
+    uint32_t  in_flight = 0;
+    uint64_t  requests  = 0;
+    uint64_t  errors    = 0;
+    Histogram latency;
+
+    Generator (const string& uri, uint32_t connections, bool accept) : uri(uri), accept(accept) {
+        Pool::Config cfg;
+        cfg.max_connections = connections;
+        pool = new Pool(cfg, loop);
+    }
+
+    void run (uint32_t connections, uint32_t duration) {
+        deadline = monotonic_ms() + duration * 1000;
+        for (uint32_t i = 0; i < connections; ++i) send();
+        loop->run();
+        pool.reset();
+    }
+
+    void send () {
+        if (monotonic_ms() >= deadline) {
+            if (!in_flight) loop->stop();
+            return;
+        }
+        ++in_flight;
+        auto start = std::chrono::steady_clock::now();
+        Request::Builder builder;
+        builder.uri(uri);
+        if (accept) builder.headers(Headers().add("Connection", "close"));
+        pool->request(builder.response_callback([this, start](auto&, auto&, auto& err) {
+            --in_flight;
+            if (err) ++errors;
+            else {
+                ++requests;
+                latency.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+            }
+            send();
+        }).build());
+    }
+};
+
+static Result run_scenario (const Scenario& sc, const Options& opts) {
+    Result res;
+    auto port = free_port();
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    auto pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (!pid) {
+        close(fds[0]);
+        run_manager(sc, port, fds[1]);
+    }
+    close(fds[1]);
+
+    char c;
+    auto ready = read(fds[0], &c, 1) == 1;
+    close(fds[0]);
+
+    if (ready) {
+        string uri = "http://127.0.0.1:" + to_string(port) + "/";
+        std::vector<std::unique_ptr<Generator>> gens;
+        for (uint32_t i = 0; i < opts.threads; ++i) gens.push_back(std::make_unique<Generator>(uri, opts.connections, opts.accept));
+
+        auto start = monotonic_ms();
+        std::vector<std::thread> threads;
+        for (auto& g : gens) threads.emplace_back([&g, &opts] { g->run(opts.connections, opts.duration); });
+        for (auto& t : threads) t.join();
+        auto elapsed = monotonic_ms() - start;
+
+        for (auto& g : gens) {
+            res.requests += g->requests;
+            res.errors   += g->errors;
+            res.latency.merge(g->latency);
+        }
+        res.rps = elapsed ? res.requests * 1000.0 / elapsed : 0;
+        res.ok  = true;
+    }
+    else fprintf(stderr, "%s: manager has not started\n", sc.model_name);
+
+    kill(pid, SIGTERM);
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    return res;
+}
+
+static std::vector<uint32_t> parse_list (const char* str) {
+    std::vector<uint32_t> ret;
+    for (auto p = str; *p; ) {
+        char* end;
+        ret.push_back(strtoul(p, &end, 10));
+        p = *end ? end + 1 : end;
+    }
+    return ret;
+}
+
+int main (int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        auto has_val = i + 1 < argc;
+        if      (!strcmp(argv[i], "-w") && has_val) opts.workers     = parse_list(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && has_val) opts.threads     = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c") && has_val) opts.connections = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-d") && has_val) opts.duration    = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-a"))            opts.accept      = true;
+        else {
+            fprintf(stderr, "usage: %s [-w workers,...] [-t generator threads] [-c connections per thread] [-d seconds] [-a]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (opts.workers.empty()) {
+        auto cpus = (uint32_t)panda::unievent::cpu_info().value().size();
+        for (uint32_t n = 1; n < cpus; n *= 2) opts.workers.push_back(n);
+        opts.workers.push_back(cpus);
+        for (uint32_t n : {32, 64}) if (n > cpus) opts.workers.push_back(n); // accept contention shows with many workers
+    }
+
+    std::vector<std::pair<const char*, Manager::WorkerModel>> models = {
+        {"prefork", Manager::WorkerModel::PreFork},
+        {"thread",  Manager::WorkerModel::Thread},
+    };
+
+    printf("{\n  \"threads\": %u, \"connections\": %u, \"duration\": %u, \"accept\": %s,\n  \"results\": [\n",
+           opts.threads, opts.connections, opts.duration, opts.accept ? "true" : "false");
+    bool first = true, all_ok = true;
+    auto all_sockets = {Sockets::Shared, Sockets::AcceptMutex, Sockets::ReusePort, Sockets::PerWorker};
+    for (auto& m : models) for (auto n : opts.workers) for (auto sockets : all_sockets) for (auto force_stop : {true, false}) {
+        if (sockets == Sockets::AcceptMutex && m.second != Manager::WorkerModel::PreFork) continue;
+        Scenario sc {m.first, m.second, n, sockets, force_stop};
+        auto res = run_scenario(sc, opts);
+        all_ok = all_ok && res.ok;
+        printf("%s    {\"model\": \"%s\", \"workers\": %u, \"sockets\": \"%s\", \"force_worker_stop\": %s, \"ok\": %s, "
+               "\"requests\": %llu, \"errors\": %llu, \"rps\": %.1f, \"p50_us\": %llu, \"p90_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu}",
+               first ? "" : ",\n", sc.model_name, n, sockets_name(sockets), force_stop ? "true" : "false", res.ok ? "true" : "false",
+               (unsigned long long)res.requests, (unsigned long long)res.errors, res.rps,
+               (unsigned long long)res.latency.percentile(0.5), (unsigned long long)res.latency.percentile(0.9),
+               (unsigned long long)res.latency.percentile(0.99), (unsigned long long)res.latency.percentile(0.999));
+        fflush(stdout);
+        first = false;
+    }
+    printf("\n  ]\n}\n");
+
+    return all_ok ? 0 : 2;
+}
@@ -0,0 +1,163 @@
+#include "Affinity.h"
+#include <ostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+#ifdef __linux__
+    #include <sched.h>
+    #include <dirent.h>
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+#endif
+
+namespace panda { namespace unievent { namespace http { namespace manager {
+
+#ifdef __linux__
+
+static const int mpol_preferred = 1; // from linux/mempolicy.h, we don't depend on libnuma
+
+// parses cpulist format, i.e. "0-3,8,10-11"
+static std::vector<uint32_t> parse_cpulist (const std::string& str) {
+    std::vector<uint32_t> ret;
+    std::stringstream ss(str);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range == "\n") continue;
+        auto dash = range.find('-');
+        try {
+            uint32_t from = std::stoul(range.substr(0, dash));
+            uint32_t to   = dash == std::string::npos ? from : std::stoul(range.substr(dash + 1));
+            for (auto cpu = from; cpu <= to; ++cpu) ret.push_back(cpu);
+        } catch (const std::logic_error&) {
+            panda_log_warning("could not parse cpu list: " << str);
+            return {};
+        }
+    }
+    return ret;
+}
+
+static std::vector<uint32_t> allowed_cpus () {
+    std::vector<uint32_t> ret;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return ret;
+    for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) ret.push_back(cpu);
+    }
+    return ret;
+}
+
+// node id -> cpus, empty if kernel doesn't expose numa topology
+static std::vector<std::pair<int, std::vector<uint32_t>>> numa_nodes () {
+    std::vector<std::pair<int, std::vector<uint32_t>>> ret;
+    auto dir = opendir("/sys/devices/system/node");
+    if (!dir) return ret;
+    while (auto entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.compare(0, 4, "node") || name.size() == 4 || !isdigit(name[4])) continue;
+        std::ifstream file("/sys/devices/system/node/" + name + "/cpulist");
+        std::string list;
+        if (!std::getline(file, list)) continue;
+        ret.emplace_back(std::atoi(name.c_str() + 4), parse_cpulist(list));
+    }
+    closedir(dir);
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+static int node_of (uint32_t cpu) {
+    for (auto& node : numa_nodes()) {
+        if (std::find(node.second.begin(), node.second.end(), cpu) != node.second.end()) return node.first;
+    }
+    return -1;
+}
+
+Placement Placement::for_slot (const Manager::Config& config, uint32_t slot) {
+    Placement ret;
+    switch (config.affinity) {
+        case Manager::Affinity::None: break;
+        case Manager::Affinity::Core: {
+            auto cpus = allowed_cpus();
+            if (cpus.empty()) break;
+            ret.cpus.push_back(cpus[slot % cpus.size()]);
+            ret.numa_node = node_of(ret.cpus.front());
+            break;
+        }
+        case Manager::Affinity::List: {
+            if (config.affinity_cpus.empty()) break;
+            ret.cpus.push_back(config.affinity_cpus[slot % config.affinity_cpus.size()]);
+            ret.numa_node = node_of(ret.cpus.front());
+            break;
+        }
+        case Manager::Affinity::NumaNode: {
+            auto allowed = allowed_cpus();
+            std::vector<std::pair<int, std::vector<uint32_t>>> nodes;
+            for (auto& node : numa_nodes()) {
+                std::vector<uint32_t> cpus;
+                for (auto cpu : node.second) {
+                    if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) cpus.push_back(cpu);
+                }
+                if (cpus.size()) nodes.emplace_back(node.first, std::move(cpus));
+            }
+            if (nodes.empty()) break; // no numa, nothing to do
+            auto& node = nodes[slot % nodes.size()];
+            ret.numa_node = node.first;
+            ret.cpus      = node.second;
+            break;
+        }
+    }
+    return ret;
+}
+
+bool Placement::apply () const {
+    if (cpus.size()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu : cpus) {
+            if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+        }
+        auto err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err) {
+            panda_log_warning("could not set cpu affinity " << *this << ", error=" << err);
+            return false;
+        }
+    }
+
+    #ifdef SYS_set_mempolicy
+    if (numa_node >= 0) {
+        const size_t bits = sizeof(unsigned long) * 8;
+        std::vector<unsigned long> mask(numa_node / bits + 1);
+        mask[numa_node / bits] |= 1UL << (numa_node % bits);
+        if (syscall(SYS_set_mempolicy, mpol_preferred, mask.data(), mask.size() * bits + 1) != 0) {
+            panda_log_warning("could not set memory policy for numa node " << numa_node);
+            return false;
+        }
+    }
+    #endif
+
+    return true;
+}
+
+#else
+
+Placement Placement::for_slot (const Manager::Config& config, uint32_t) {
+    if (config.affinity != Manager::Affinity::None) panda_log_warning("ignored affinity configuration parameter: only supported on linux");
+    return {};
+}
+
+bool Placement::apply () const { return cpus.empty(); }
+
+#endif
+
+std::ostream& operator<< (std::ostream& os, const Placement& p) {
+    os << "cpus=";
+    for (size_t i = 0; i < p.cpus.size(); ++i) os << (i ? "," : "") << p.cpus[i];
+    if (p.numa_node >= 0) os << " node=" << p.numa_node;
+    return os;
+}
+
+}}}}
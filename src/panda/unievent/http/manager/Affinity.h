@@ -0,0 +1,21 @@
+#pragma once
+#include "Manager.h"
+#include <vector>
+
+namespace panda { namespace unievent { namespace http { namespace manager {
+
+// where a worker with given placement slot runs according to config.affinity. Placement slots are assigned by master
+// (lowest free one), so a worker replacing a terminated one takes its cpu.
+struct Placement {
+    std::vector<uint32_t> cpus;           // empty - don't pin
+    int                   numa_node = -1; // node to prefer for memory allocations, -1 - don't bind
+
+    static Placement for_slot (const Manager::Config&, uint32_t slot);
+
+    // binds calling thread (the whole process if called from main thread before creating others) and its memory policy
+    bool apply () const;
+};
+
+std::ostream& operator<< (std::ostream&, const Placement&);
+
+}}}}
@@ -1,23 +1,45 @@
 #include "Child.h"
+#include "Affinity.h"
 #include <iomanip>
 #include <thread>
+#include <chrono>
+#include <algorithm>
+#include <panda/unievent/util.h>
 
 namespace panda { namespace unievent { namespace http { namespace manager {
 
 void Child::init (ServerParams p) {
+    if (p.placement_slot >= 0) {
+        auto placement = Placement::for_slot(p.config, p.placement_slot);
+        if (placement.apply()) panda_log_info("worker: bound to " << placement);
+    }
+
     panda_log_debug("worker: creating server");
     loop = p.loop;
     loop->track_load_average(p.config.load_average_period);
 
-    if (p.server_factory) server = p.server_factory(p.config.server, loop);
+    auto server_config = p.config.server;
+    if (p.listen_socks.size()) use_listen_socks(server_config, p.listen_socks);
+    if (p.config.accept_mutex) {
+        accept_cfg.config = server_config;
+        for (auto& loc : server_config.locations) accept_cfg.serialized.push_back(serialized(p.config, loc));
+        server_config = accept_server_config(false);
+    }
+
+    if (p.server_factory) server = p.server_factory(server_config, loop);
     else {
         server = new Server(loop);
-        server->configure(p.config.server);
+        server->configure(server_config);
     }
 
     if (p.request_event.has_listeners()) server->request_event = p.request_event;
 
     force_stop = p.config.force_worker_stop;
+    standby    = p.standby;
+
+    notify_cfg.interval = p.config.notify_interval;
+    notify_cfg.busy     = p.config.min_spare_servers; // spare servers are counted by idle workers
+    notify_cfg.max_load = p.config.max_load;
 
     p.spawn_event(server);
 
@@ -25,9 +47,13 @@ void Child::init (ServerParams p) {
         ++reqcnt.total;
         ++reqcnt.recent;
         send_active_requests(++reqcnt.active);
+        if (reqcnt.active == 1 && notify_cfg.busy) notify();
 
-        req->finish_event.add([this](auto&) {
+        auto start = std::chrono::steady_clock::now();
+        req->finish_event.add([this, start](auto&) {
             send_active_requests(--reqcnt.active);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            send_request_time(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
         });
     });
 
@@ -39,29 +65,147 @@ void Child::init (ServerParams p) {
         loop->update_time();
         la_last_time = loop->now();
         float speed = reqcnt.recent * 1000 / (la_last_time == prev_time ?  1 : la_last_time - prev_time);
+        auto la = loop->get_load_average();
         panda_log_debug(
-            "worker: load average=" << std::setprecision(3) << std::fixed << loop->get_load_average() <<
+            "worker: load average=" << std::setprecision(3) << std::fixed << la <<
             ", speed " << std::setprecision(speed > 10 ? 0 : 1) << std::fixed << speed << " req/s" <<
             ", total " << reqcnt.total << " reqs"
         );
-        send_activity(std::time(NULL), loop->get_load_average(), reqcnt.total, reqcnt.recent);
+        uint32_t lag_p99 = lag.hist.percentile(0.99);
+        uint32_t lag_max = lag.max;
+        if (lag.hist.count) panda_log_debug("worker: loop lag p99=" << lag_p99 << "us, max=" << lag_max << "us");
+        send_memory_usage();
+        send_activity(monotonic_ms(), la, reqcnt.total, reqcnt.recent, open_connections(), lag_max, lag_p99);
         reqcnt.recent = 0;
+        lag.hist.clear();
+        lag.max = 0;
+        if (notify_cfg.max_load && la >= notify_cfg.max_load && la_last < notify_cfg.max_load) notify(); // load spike
+        la_last = la;
     }, loop);
     la_timer->weak(true);
+
+    if (p.config.lag_probe_interval) {
+        lag.interval  = p.config.lag_probe_interval * 1000;
+        lag.last_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        send_probe_time(lag.last_time / 1000);
+        lag_timer = Timer::create(p.config.lag_probe_interval, [this](auto&) { probe_lag(); }, loop);
+        lag_timer->weak(true);
+    }
+}
+
+void Child::probe_lag () {
+    // the same clock as monotonic_ms(), but precise enough for sub-millisecond lag
+    uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    uint64_t expected = lag.last_time + lag.interval;
+    uint64_t value    = now > expected ? now - expected : 0;
+    lag.hist.record(value);
+    if (value > lag.max) lag.max = value;
+    lag.last_time = now;
+    send_probe_time(now / 1000);
 }
 
 void Child::run () {
-    panda_log_info("worker: running");
-    server->run();
-    send_activity(std::time(NULL), 0, 0, 0); // mark as ready
+    if (standby) {
+        panda_log_info("worker: standing by");
+        send_activity(monotonic_ms(), 0, 0, 0, 0, 0, 0); // mark as ready to be activated
+    }
+    else start();
     loop->run();
     panda_log_info("worker: end running, total requests served: " << reqcnt.total);
 }
 
+void Child::start () {
+    panda_log_info("worker: running");
+    server->run();
+    watch_listeners();
+    send_activity(monotonic_ms(), 0, 0, 0, 0, 0, 0); // mark as ready
+}
+
+void Child::watch_listeners () {
+    std::vector<StreamSP> current;
+    for (auto& listener : server->listeners()) {
+        current.push_back(listener);
+        auto known = std::find_if(listeners.begin(), listeners.end(), [&](auto& l) { return l.get() == listener.get(); });
+        if (known != listeners.end()) continue;
+        listener->connection_event.add([this](auto&, auto& client, auto& err) {
+            if (!err) track_connection(client);
+        });
+    }
+    listeners = std::move(current);
+}
+
+// accept_mutex: worker takes turns by reconfiguring its running server. Listeners close their sockets when server
+// recreates them, so server gets copies and the worker keeps its own ones, connections queued on them are not lost
+void Child::listen_serialized (bool on) {
+    if (accept_cfg.listening == on) return;
+    accept_cfg.listening = on;
+    server->configure(accept_server_config(on));
+    watch_listeners();
+}
+
+Server::Config Child::accept_server_config (bool with_serialized) const {
+    Server::Config ret = accept_cfg.config;
+    ret.locations.clear();
+    for (size_t i = 0; i < accept_cfg.config.locations.size(); ++i) {
+        if (accept_cfg.serialized[i] && !with_serialized) continue;
+        auto loc = accept_cfg.config.locations[i];
+        if (loc.sock) loc.sock = sock_dup(loc.sock.value());
+        ret.locations.push_back(loc);
+    }
+    return ret;
+}
+
+void Child::track_connection (const StreamSP& conn) {
+    conns.list.push_back(conn);
+    if (conns.list.size() >= conns.alive * 2 + 1024) open_connections(); // short-lived connections between heartbeats
+}
+
+uint32_t Child::open_connections () {
+    auto& list = conns.list;
+    list.erase(std::remove_if(list.begin(), list.end(), [](auto& conn) { return conn.expired(); }), list.end());
+    return conns.alive = list.size();
+}
+
+void Child::notify () {
+    if (!notify_cfg.interval) return;
+    loop->update_time();
+    auto now = loop->now();
+    if (notify_cfg.last_time && now - notify_cfg.last_time < notify_cfg.interval) return;
+    notify_cfg.last_time = now;
+    send_notification();
+}
+
+void Child::activate () {
+    if (!standby || terminating) return;
+    standby = false;
+    start();
+}
+
+bool Child::serialized (const Manager::Config& config, const Server::Location& loc) {
+    return config.accept_mutex && loc.host && loc.sock && !loc.reuse_port && !loc.ssl_ctx;
+}
+
+bool Child::per_worker (const Manager::Config& config, const Server::Location& loc) {
+    return config.per_worker_sockets && loc.reuse_port && loc.host && !loc.sock;
+}
+
+void Child::use_listen_socks (Server::Config& config, const std::vector<sock_t>& socks) {
+    size_t i = 0;
+    for (auto& loc : config.locations) {
+        if (!loc.reuse_port || !loc.host || loc.sock || i == socks.size()) continue;
+        loc.sock = socks[i++];
+        loc.host = ""; // the same as for sockets bound by master in shared mode
+    }
+}
+
 void Child::terminate () {
     panda_log_info("worker: terminating...");
     if (terminating) return;
     terminating = true;
+    if (standby) { // server has never been run, nothing to drain
+        loop->stop();
+        return;
+    }
     server->stop_event.add([this]() {
         if (force_stop) {
             panda_log_debug("worker: server is gracefully stopped. unblocking loop...");
@@ -1,9 +1,17 @@
 #pragma once
 #include "Manager.h"
+#include "Histogram.h"
+#include <chrono>
 #include <panda/unievent/Signal.h>
+#include <panda/unievent/Stream.h>
 
 namespace panda { namespace unievent { namespace http { namespace manager {
 
+// heartbeats and worker timestamps; monotonic clock is system-wide, so values are comparable between master and worker processes
+inline uint64_t monotonic_ms () {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 struct Child {
     struct ServerParams {
         const LoopSP&               loop;
@@ -11,21 +19,52 @@ struct Child {
         Manager::server_factory_fn& server_factory;
         Manager::spawn_cd&          spawn_event;
         Manager::request_cd&        request_event;
+        bool                        standby = false; // initialize but don't run server until activate()
+        int32_t                     placement_slot = -1;
+        std::vector<sock_t>         listen_socks   = {}; // owned by worker, see use_listen_socks()
     };
 
     virtual void init      (ServerParams);
     virtual void run       ();
+    virtual void activate  ();
     virtual void terminate ();
 
+    // shared location which workers accept on one at a time (accept_mutex mode, see PreForkChild)
+    static bool serialized (const Manager::Config&, const Server::Location&);
+
+    // reuse_port location served on a socket bound by master (per_worker_sockets mode)
+    static bool per_worker (const Manager::Config&, const Server::Location&);
+
+    // serve reuse_port locations on master's sockets, one per such location in order, instead of binding own ones
+    static void use_listen_socks (Server::Config&, const std::vector<sock_t>&);
+
     virtual ~Child () {}
 
 protected:
     LoopSP   loop;
     ServerSP server;
     TimerSP  la_timer;
+    TimerSP  lag_timer;
     uint64_t la_last_time = 0;
+    float    la_last      = 0;
     bool     force_stop   = false;
     bool     terminating  = false;
+    bool     standby      = false;
+
+    std::vector<StreamSP> listeners; // of server, connections accepted on them are tracked
+
+    struct {
+        Server::Config    config;     // all locations, worker owns their sockets and server listens on copies
+        std::vector<bool> serialized; // per location of config
+        bool              listening = false;
+    } accept_cfg; // accept_mutex only
+
+    struct {
+        uint64_t interval  = 0; // 0 if disabled
+        uint64_t last_time = 0;
+        bool     busy      = false; // when worker stops being spare
+        float    max_load  = 0;     // when load crosses it
+    } notify_cfg;
 
     struct {
         uint32_t active = 0;
@@ -33,8 +72,37 @@ protected:
         uint32_t recent = 0;
     } reqcnt;
 
+    struct {
+        uint64_t  interval  = 0; // us
+        uint64_t  last_time = 0; // us of steady clock
+        uint64_t  max       = 0;
+        Histogram hist;          // since previous heartbeat
+    } lag;
+
+    struct {
+        std::vector<weak_iptr<Stream>> list;      // server owns connections, closed ones expire
+        size_t                         alive = 0; // as of the last prune
+    } conns;
+
+    void start  ();
+    void notify (); // rate-limited send_notification()
+
+    void listen_serialized (bool); // accept_mutex: reconfigure running server to listen on serialized locations or not
+    void watch_listeners   ();     // track connections accepted by listeners which server has (re)created
+
+    Server::Config accept_server_config (bool with_serialized) const;
+
+    void     probe_lag        ();
+
+    void     track_connection (const StreamSP&);
+    uint32_t open_connections (); // prunes closed connections
+
     virtual void send_active_requests (uint32_t) = 0;
-    virtual void send_activity        (time_t now, float la, uint32_t total_requests, uint32_t recent_requests) = 0;
+    virtual void send_request_time    (uint64_t us) = 0;
+    virtual void send_activity        (uint64_t now, float la, uint32_t total_requests, uint32_t recent_requests, uint32_t connections, uint32_t lag_max, uint32_t lag_p99) = 0;
+    virtual void send_probe_time      (uint64_t now) = 0; // on each tick of lag probe
+    virtual void send_notification    () = 0;
+    virtual void send_memory_usage    () = 0; // reads and reports memory usage (see max_worker_rss)
 };
 
 }}}}
@@ -0,0 +1,60 @@
+#include "Histogram.h"
+#include <cmath>
+
+namespace panda { namespace unievent { namespace http { namespace manager {
+
+static inline uint32_t msb_index (uint64_t v) {
+    uint32_t ret = 0;
+    while (v >>= 1) ++ret;
+    return ret;
+}
+
+uint32_t Histogram::bucket_index (uint64_t us) {
+    if (us < sub_buckets) return (uint32_t)us;
+    auto msb = msb_index(us);
+    if (msb > max_msb) return buckets_count - 1;
+    auto shift = msb - sub_bits;
+    return (shift + 1) * sub_buckets + (uint32_t)(us >> shift) - sub_buckets;
+}
+
+uint64_t Histogram::bucket_limit (uint32_t idx) {
+    if (idx < sub_buckets) return idx + 1;
+    auto shift    = idx / sub_buckets - 1;
+    auto mantissa = idx % sub_buckets + sub_buckets;
+    return uint64_t(mantissa + 1) << shift;
+}
+
+void Histogram::fetch (const Shared& shared, uint32_t (&seen)[buckets_count]) {
+    count = 0;
+    for (uint32_t i = 0; i < buckets_count; ++i) {
+        uint32_t cur = shared.buckets[i].load(std::memory_order_relaxed);
+        buckets[i] = cur - seen[i];
+        seen[i] = cur;
+        count += buckets[i];
+    }
+}
+
+void Histogram::clear () {
+    for (auto& b : buckets) b = 0;
+    count = 0;
+}
+
+void Histogram::merge (const Histogram& h) {
+    if (!h.count) return;
+    for (uint32_t i = 0; i < buckets_count; ++i) buckets[i] += h.buckets[i];
+    count += h.count;
+}
+
+uint64_t Histogram::percentile (double q) const {
+    if (!count) return 0;
+    uint64_t rank = (uint64_t)std::ceil(q * count);
+    if (!rank) rank = 1;
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < buckets_count; ++i) {
+        sum += buckets[i];
+        if (sum >= rank) return bucket_limit(i);
+    }
+    return bucket_limit(buckets_count - 1);
+}
+
+}}}}
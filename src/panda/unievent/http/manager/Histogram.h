@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace panda { namespace unievent { namespace http { namespace manager {
+
+// Log-linear histogram of durations in microseconds: exact below 8us, then 8 sub-buckets per power of two (~12% precision),
+// values above ~134s fall into the last bucket.
+struct Histogram {
+    static const uint32_t sub_bits      = 3;
+    static const uint32_t sub_buckets   = 1 << sub_bits;
+    static const uint32_t max_msb       = 26;
+    static const uint32_t buckets_count = (max_msb - sub_bits + 2) * sub_buckets;
+
+    // lives in memory shared between worker (the only writer) and master; counters are monotonic and may wrap
+    struct Shared {
+        std::atomic<uint32_t> buckets[buckets_count];
+
+        void reset () {
+            for (auto& b : buckets) b = 0;
+        }
+
+        void record (uint64_t us) {
+            auto& b = buckets[Histogram::bucket_index(us)];
+            b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        void add (const Histogram& h) {
+            if (!h.count) return;
+            for (uint32_t i = 0; i < buckets_count; ++i) {
+                if (h.buckets[i]) buckets[i].store(buckets[i].load(std::memory_order_relaxed) + h.buckets[i], std::memory_order_relaxed);
+            }
+        }
+    };
+
+    uint64_t buckets[buckets_count] = {};
+    uint64_t count = 0;
+
+    static uint32_t bucket_index (uint64_t us);
+    static uint64_t bucket_limit (uint32_t idx); // upper bound (exclusive) of bucket values
+
+    // fills this histogram with counts recorded in shared since the previous call, `seen` keeps previous shared state
+    void fetch (const Shared& shared, uint32_t (&seen)[buckets_count]);
+
+    void record (uint64_t us) {
+        ++buckets[bucket_index(us)];
+        ++count;
+    }
+
+    void clear ();
+    void merge (const Histogram&);
+
+    uint64_t percentile (double q) const; // q in {0-1}, returns microseconds, 0 if empty
+};
+
+}}}}
@@ -18,7 +18,8 @@ Manager::Manager (const Config& config, LoopSP master_loop, LoopSP worker_loop)
     switch (config.worker_model) {
         case WorkerModel::Thread  : mpm = new StlThread(config, master_loop, worker_loop); break;
         #ifndef _WIN32
-        case WorkerModel::PreFork : mpm = new PreFork(config, master_loop, worker_loop); break;
+        case WorkerModel::PreFork :
+        case WorkerModel::Hybrid  : mpm = new PreFork(config, master_loop, worker_loop); break; // hybrid worker processes run thread model inside
         #endif
         default : throw exception("selected worker model is not supported on current OS");
     }
@@ -34,9 +35,12 @@ const Manager::Config& Manager::config () const {
 
 void Manager::run () {
     mpm->server_factory = server_factory;
+    mpm->preload_event  = preload_event;
     mpm->start_event    = start_event;
     mpm->spawn_event    = spawn_event;
     mpm->request_event  = request_event;
+    mpm->stats_event    = stats_event;
+    mpm->restart_event  = restart_event;
     mpm->run();
 }
 
@@ -48,6 +52,10 @@ void Manager::restart_workers () {
     mpm->restart_workers();
 }
 
+Manager::Stats Manager::stats () const {
+    return mpm->stats();
+}
+
 excepted<void, string> Manager::reconfigure (const Config& cfg) {
     return mpm->reconfigure(cfg);
 }
@@ -60,14 +68,57 @@ std::ostream& operator<< (std::ostream& os, const Manager::Config& config) {
     os << "{";
     os << "servers: <" << config.min_servers << "-" << config.max_servers << ">";
     if (config.min_spare_servers) os << ", spare servers: <" << config.min_spare_servers << "-" << config.max_spare_servers << ">";
+    if (config.standby_servers)   os << ", standby servers: " << config.standby_servers;
+    if (config.max_connections_per_worker) {
+        os << ", connections per server: " << config.max_connections_per_worker << " <" << config.min_spare_connections << " spare>";
+    }
     if (config.max_load)          os << ", load: <" << config.min_load << "-" << config.max_load << " for " << config.load_average_period << "s>";
-    os << ", mpm: " << (config.worker_model == Manager::WorkerModel::PreFork ? "prefork" : "thread");
+    if (config.lag_probe_interval) {
+        os << ", loop lag probe: " << config.lag_probe_interval << "ms";
+        if (config.max_loop_lag) os << " <max " << config.max_loop_lag << "ms>";
+        if (config.loop_stall_timeout) os << " <stall timeout " << config.loop_stall_timeout << "s>";
+    }
+    if (config.target_p99_latency) {
+        os << ", p99 latency: " << config.target_p99_latency << "ms <cooldown " << config.latency_cooldown << "s>";
+    }
+    if (config.notify_interval)   os << ", notifications: " << config.notify_interval << "ms";
+    if (config.metrics_location.host) os << ", metrics: " << config.metrics_location.host << ":" << config.metrics_location.port;
+    else if (config.metrics_location.path) os << ", metrics: " << config.metrics_location.path;
+    switch (config.worker_model) {
+        case Manager::WorkerModel::PreFork : os << ", mpm: prefork"; break;
+        case Manager::WorkerModel::Thread  : os << ", mpm: thread"; break;
+        case Manager::WorkerModel::Hybrid  : os << ", mpm: hybrid <" << config.threads_per_worker << " threads per worker>"; break;
+    }
+    if (config.scaling_model == Manager::ScalingModel::Pid) {
+        os << ", scaling: pid <target load " << config.target_load << ", alpha " << config.ewma_alpha
+           << ", kp " << config.pid_kp << ", ki " << config.pid_ki << ", kd " << config.pid_kd << ">";
+    }
     if (config.max_requests) os << ", max_requests: " << config.max_requests;
     os << ", min_worker_ttl: " << config.min_worker_ttl << "s";
     if (config.activity_timeout) os << ", activity_timeout: " << config.activity_timeout << "s";
     if (config.termination_timeout) os << ", termination_timeout: " << config.termination_timeout << "s";
+    if (config.max_surge) os << ", max_surge: " << config.max_surge;
+    os << ", victims: " << (config.victim_selection == Manager::VictimSelection::DrainCost ? "drain cost" : "most requests");
+    if (config.max_worker_rss) os << ", max_worker_rss: " << config.max_worker_rss;
+    if (config.memory_details_interval && config.worker_model != Manager::WorkerModel::Thread) {
+        os << ", memory details every " << config.memory_details_interval << "s";
+    }
     os << ", check_interval: " << config.check_interval << "s";
     if (config.force_worker_stop) os << ", force_worker_stop: true";
+    if (config.zygote) os << ", zygote: true";
+    if (config.per_worker_sockets) os << ", per_worker_sockets: true";
+    if (config.accept_mutex) os << ", accept_mutex: <load " << config.accept_max_load << ", delay " << config.accept_mutex_delay << "ms>";
+    switch (config.affinity) {
+        case Manager::Affinity::None     : break;
+        case Manager::Affinity::Core     : os << ", affinity: core"; break;
+        case Manager::Affinity::NumaNode : os << ", affinity: numa"; break;
+        case Manager::Affinity::List     : {
+            os << ", affinity: <";
+            for (size_t i = 0; i < config.affinity_cpus.size(); ++i) os << (i ? "," : "") << config.affinity_cpus[i];
+            os << ">";
+            break;
+        }
+    }
     os << ", server: " << config.server;
     return os;
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <iosfwd>
+#include <vector>
 #include <panda/excepted.h>
 #include <panda/unievent/http/Server.h>
 
@@ -10,7 +11,11 @@ struct Mpm;
 extern log::Module panda_log_module;
 
 struct Manager : Refcnt {
-    enum class WorkerModel { PreFork, Thread };
+    enum class WorkerModel  { PreFork, Thread, Hybrid };
+    enum class ScalingModel { Threshold, Pid };
+    enum class Affinity     { None, Core, NumaNode, List };
+    enum class VictimSelection { DrainCost, MostRequests };
+    enum class WorkerState  { starting = 1, running = 2, restarting = 4, terminating = 8, standby = 16 };
 
     #ifdef _WIN32
         static const WorkerModel def_wm = WorkerModel::Thread;
@@ -24,17 +29,102 @@ struct Manager : Refcnt {
         uint32_t       max_servers = 0;          // The maximum number of child servers to start. [number of cpu threads]
         uint32_t       min_spare_servers = 0;    // The minimum number of servers to have waiting for requests.
         uint32_t       max_spare_servers = 0;    // The maximum number of servers to have waiting for requests. [min_spare_server + min_servers, if min_spare_servers]
+        uint32_t       standby_servers = 0;      // The number of initialized but not yet serving workers kept for instant scale up (within max_servers)
+        uint32_t       max_connections_per_worker = 0; // open connections a worker is meant to hold: workers are spawned to keep capacity for open connections
+                                                   // and not terminated if the rest couldn't hold them [0=don't scale on connections]
+        uint32_t       min_spare_connections = 0; // capacity to keep free above open connections, with max_connections_per_worker
         float          min_load = 0;             // minimum average loop load on workers {0-1} [max_load/2 if max_load]
         float          max_load = 0;             // maximum average loop load on workers {0-1} [0.7 if !min_spare_servers]
         uint32_t       load_average_period = 3;  // number of seconds to collect load average for, on workers
+        uint32_t       lag_probe_interval = 0;   // workers measure event loop lag: how late a timer with this interval (ms) fires [0=disable]
+        float          max_loop_lag = 0;         // ms: spawn workers while p99 loop lag of workers is above it, see lag_probe_interval [0=don't scale on lag]
+        float          loop_stall_timeout = 0;   // kill worker whose loop has not run lag probe for this number of seconds, unlike activity_timeout
+                                                   // it doesn't have to span heartbeats, see lag_probe_interval [0=disable]
+        float          target_p99_latency = 0;   // milliseconds: spawn workers while p99 of request durations is above it, terminate only after
+                                                   // it stayed below half of it for latency_cooldown [0=don't scale on latency]
+        float          latency_cooldown = 30;    // seconds, see target_p99_latency; also the least time between spawns for max_loop_lag
         uint32_t       max_requests = 0;         // max number of the requests to process per one worker process [0=unlimited]
-        uint32_t       min_worker_ttl = 60;      // Minimum number of seconds between starting and killing a worker
+        uint64_t       max_worker_rss = 0;       // restart worker which uses more memory (bytes): resident memory of worker process or,
+                                                   // in thread model, memory allocated by worker thread (jemalloc only) [0=unlimited]
+        float          memory_details_interval = 10; // prefork: workers report shared/private memory from smaps_rollup every this number of seconds [0=disable]
+        float          min_worker_ttl = 60;      // Minimum number of seconds between starting and killing a worker
         float          check_interval = 1;       // interval between checking to see if we can kill off some waiting servers or if we need to spawn more workers
-        uint32_t       activity_timeout = 0;     // kill worker if it's not responding for this number of seconds [0=disable]
-        uint32_t       termination_timeout = 10; // kill worker if it's not terminated after this number of seconds [0=disable]
+                                                   // (seconds, sub-second values are fine). workers send heartbeats at the same interval
+        uint32_t       notify_interval = 100;    // workers notify master when ready, busy or overloaded; master checks them at most once per this number of milliseconds [0=polling only]
+        float          activity_timeout = 0;     // kill worker if it's not responding for this number of seconds, should span several heartbeats [0=disable]
+        float          termination_timeout = 10; // kill worker if it's not terminated after this number of seconds [0=disable]
+        uint32_t       max_surge = 0;            // rolling restart: replace at most this number of workers at a time, next ones are replaced
+                                                   // when previous replacements start serving [0=all at once]
         WorkerModel    worker_model = def_wm;    // Multi-processing module type
+        uint32_t       threads_per_worker = 0;   // hybrid: maximum number of loop threads in each worker process [cpu threads / max_servers, at least 1]
+        ScalingModel   scaling_model = ScalingModel::Threshold; // algorithm which decides how many workers to spawn/terminate
+        VictimSelection victim_selection = VictimSelection::DrainCost; // which workers to terminate when scaling down: the cheapest to drain
+                                                   // (fewest active requests and open connections, then lowest load) or the most used ones
+        float          target_load = 0.5;        // pid: average loop load on workers to keep {0-1}
+        float          ewma_alpha = 0.3;         // pid: smoothing factor for load average and request rate {0-1}, higher reacts faster
+        float          pid_kp = 1;               // pid: proportional gain
+        float          pid_ki = 0.2;             // pid: integral gain
+        float          pid_kd = 0.5;             // pid: derivative gain (applied to request rate trend)
         bool           force_worker_stop = true; // if true, stop worker's loop immediately after http server is gracefully stopped
                                                    // if false, do not stop loop and let it stop when no more active handle remains
+        bool           zygote = false;           // prefork: fork workers from a lean template process forked once after start_event (linux only)
+        Affinity       affinity = Affinity::None; // pin workers: one cpu per worker, numa nodes round-robin or cpus from affinity_cpus (linux only)
+        std::vector<uint32_t> affinity_cpus;     // cpus to pin workers to (round-robin) for Affinity::List
+        bool           per_worker_sockets = false; // reuse_port locations: master binds a socket per worker and keeps it open across the worker's
+                                                   // restart, so connections queued on it are served by the replacement instead of being reset (unix only)
+        bool           accept_mutex = false;     // prefork: on shared (non-reuse_port tcp) locations workers take turns accepting, so that a new
+                                                   // connection wakes up one worker instead of all of them. reuse_port locations need per_worker_sockets
+        float          accept_max_load = 0;      // accept_mutex: worker with higher load average leaves accepting to less loaded ones [max_load or 0.7]
+        uint32_t       accept_mutex_delay = 10;  // accept_mutex: milliseconds between attempts of a worker to take its turn
+        Server::Location metrics_location;       // master serves OpenMetrics text on this location, never through workers [disabled if no host/path/sock]
+    };
+
+    // aggregates computed on each check of workers
+    struct CheckStats {
+        uint32_t total       = 0; // starting + running workers
+        uint32_t inactive    = 0; // workers without active requests
+        uint64_t connections = 0; // open connections of starting and running workers
+        float    sumload     = 0; // sum of load averages of all workers
+        float    avgload     = 0;
+        float    req_speed   = 0; // requests per second since previous check
+        float    p99_latency = 0; // ms, of requests finished since previous check, 0 if none
+        float    loop_lag    = 0; // ms, the highest p99 loop lag of workers since their previous heartbeat
+        float    interval    = 0; // seconds since previous check
+    };
+
+    struct Counters {
+        uint64_t spawned             = 0;
+        uint64_t restarted           = 0;
+        uint64_t killed              = 0;
+        uint64_t spawn_latency_sum   = 0; // ms from spawn to serving, standby activations are not counted
+        uint64_t spawn_latency_count = 0;
+    };
+
+    struct WorkerStats {
+        uint64_t    id;
+        string      system_id;       // pid or thread id
+        WorkerState state;
+        size_t      active_requests;
+        size_t      connections;     // open connections, if reported by worker
+        size_t      total_requests;
+        size_t      recent_requests; // between the last two checks
+        float       load_average;
+        uint32_t    loop_lag_max;    // us, since previous heartbeat, see lag_probe_interval
+        uint32_t    loop_lag_p99;
+        uint64_t    memory;          // bytes, see max_worker_rss
+        uint64_t    memory_pss;      // prefork: bytes, see memory_details_interval
+        uint64_t    memory_shared;
+        uint64_t    memory_private;
+        uint64_t    spawn_time;      // the times are milliseconds of steady clock
+        uint64_t    creation_time;   // differs from spawn_time if inherited on restart or activated from standby
+        uint64_t    ready_time;      // 0 if not yet serving
+        uint64_t    activity_time;   // last heartbeat
+    };
+
+    struct Stats {
+        CheckStats               last_check;
+        Counters                 counters;
+        std::vector<WorkerStats> workers;
     };
 
     using start_fptr        = void();
@@ -45,11 +135,21 @@ struct Manager : Refcnt {
     using spawn_fn          = function<spawn_fptr>;
     using spawn_cd          = CallbackDispatcher<spawn_fptr>;
     using request_cd        = decltype(std::declval<Server>().request_event);
-
+    using stats_fptr        = void(const CheckStats&);
+    using stats_fn          = function<stats_fptr>;
+    using stats_cd          = CallbackDispatcher<stats_fptr>;
+    using restart_fptr      = void(uint32_t replaced, uint32_t total);
+    using restart_fn        = function<restart_fptr>;
+    using restart_cd        = CallbackDispatcher<restart_fptr>;
+
+    start_cd          preload_event; // in master before sockets are bound and any worker is created. In prefork model, data loaded
+                                     // here is shared with workers copy-on-write instead of being loaded by each worker in spawn_event
     start_cd          start_event;
     server_factory_fn server_factory;
     spawn_cd          spawn_event;
     request_cd        request_event;
+    stats_cd          stats_event;   // after each check of workers, in master loop
+    restart_cd        restart_event; // restart_workers()/reconfigure progress, replaced == total when finished
 
     Manager (const Config&, LoopSP = {}, LoopSP = {});
     Manager (Mpm*);
@@ -62,6 +162,8 @@ struct Manager : Refcnt {
 
     void restart_workers ();
 
+    Stats stats () const; // snapshot of master's view of workers as of the last check
+
     excepted<void, string> reconfigure (const Config&);
 
     virtual ~Manager ();
@@ -0,0 +1,92 @@
+#include "Memory.h"
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#if defined(__GNUC__) && !defined(_WIN32)
+// jemalloc's control interface; resolved only if jemalloc is linked into the process
+extern "C" int mallctl (const char*, void*, size_t*, void*, size_t) __attribute__((weak));
+#endif
+
+namespace panda { namespace unievent { namespace http { namespace manager {
+
+uint64_t process_rss () {
+    #ifdef __linux__
+    // plain read(2) into stack buffer: called periodically in every worker, so it must not allocate
+    static const long page_size = sysconf(_SC_PAGESIZE);
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+    char buf[128];
+    auto len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return 0;
+    buf[len] = 0;
+    unsigned long size, resident;
+    if (sscanf(buf, "%lu %lu", &size, &resident) != 2) return 0;
+    return (uint64_t)resident * page_size;
+    #else
+    return 0;
+    #endif
+}
+
+bool process_memory_details (MemoryDetails& md) {
+    #ifdef __linux__
+    int fd = open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+    char buf[4096]; // whole file is about 1KB
+    auto len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return false;
+    buf[len] = 0;
+
+    md = MemoryDetails();
+    for (char* line = buf; line && *line; ) {
+        auto next = strchr(line, '\n');
+        if (next) *next++ = 0;
+        char name[32];
+        unsigned long kb;
+        if (sscanf(line, "%31[^:]: %lu kB", name, &kb) == 2) {
+            uint64_t bytes = (uint64_t)kb * 1024;
+            if      (!strcmp(name, "Pss"))           md.pss    += bytes;
+            else if (!strcmp(name, "Shared_Clean"))  md.shared += bytes;
+            else if (!strcmp(name, "Shared_Dirty"))  md.shared += bytes;
+            else if (!strcmp(name, "Private_Clean")) md.priv   += bytes;
+            else if (!strcmp(name, "Private_Dirty")) md.priv   += bytes;
+        }
+        line = next;
+    }
+    return true;
+    #else
+    (void)md;
+    return false;
+    #endif
+}
+
+bool thread_allocated_supported () {
+    #if defined(__GNUC__) && !defined(_WIN32)
+    return mallctl != nullptr;
+    #else
+    return false;
+    #endif
+}
+
+uint64_t thread_allocated () {
+    #if defined(__GNUC__) && !defined(_WIN32)
+    if (!mallctl) return 0;
+    uint64_t allocated, deallocated;
+    size_t sz = sizeof(uint64_t);
+    if (mallctl("thread.allocated", &allocated, &sz, nullptr, 0) != 0) return 0;
+    sz = sizeof(uint64_t);
+    if (mallctl("thread.deallocated", &deallocated, &sz, nullptr, 0) != 0) return 0;
+    return allocated > deallocated ? allocated - deallocated : 0; // thread may free memory allocated by others
+    #else
+    return 0;
+    #endif
+}
+
+}}}}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+
+namespace panda { namespace unievent { namespace http { namespace manager {
+
+// resident memory of calling process in bytes (from /proc/self/statm), 0 if not available on this platform
+uint64_t process_rss ();
+
+// bytes allocated and not yet freed by calling thread. Only allocators exposing per-thread counters are supported
+// (jemalloc, detected at runtime), 0 otherwise
+uint64_t thread_allocated ();
+bool     thread_allocated_supported ();
+
+// breakdown of process memory from /proc/self/smaps_rollup (linux 4.14+), bytes
+struct MemoryDetails {
+    uint64_t pss      = 0; // proportional set size: private pages plus fair share of shared ones
+    uint64_t shared   = 0; // resident pages shared with other processes (i.e. copy-on-write pages inherited from master)
+    uint64_t priv     = 0; // resident pages used only by this process
+};
+
+// walks page tables of the whole process, so it is much more expensive than process_rss(); false if not available
+bool process_memory_details (MemoryDetails&);
+
+}}}}
@@ -0,0 +1,164 @@
+#include "Metrics.h"
+#include "Mpm.h"
+#include <cinttypes>
+#include <cstdio>
+
+namespace panda { namespace unievent { namespace http { namespace manager {
+
+#define METRIC_PREFIX "unievent_http_manager_"
+
+static const char* state_name (Worker::State state) {
+    switch (state) {
+        case Worker::State::starting    : return "starting";
+        case Worker::State::running     : return "running";
+        case Worker::State::restarting  : return "restarting";
+        case Worker::State::terminating : return "terminating";
+        case Worker::State::standby     : return "standby";
+    }
+    return "unknown";
+}
+
+// numbers are formatted on stack to avoid temporary strings
+static void append (string& out, uint64_t val) {
+    char tmp[24];
+    auto len = snprintf(tmp, sizeof(tmp), "%" PRIu64, val);
+    out.append(tmp, len);
+}
+
+static void append (string& out, double val) {
+    char tmp[32];
+    auto len = snprintf(tmp, sizeof(tmp), "%.6g", val);
+    out.append(tmp, len);
+}
+
+static void header (string& out, const char* name, const char* type, const char* help) {
+    out += "# TYPE " METRIC_PREFIX;
+    out += name;
+    out += ' ';
+    out += type;
+    out += "\n# HELP " METRIC_PREFIX;
+    out += name;
+    out += ' ';
+    out += help;
+    out += '\n';
+}
+
+template <typename T>
+static void sample (string& out, const char* name, T val) {
+    out += METRIC_PREFIX;
+    out += name;
+    out += ' ';
+    append(out, val);
+    out += '\n';
+}
+
+template <typename T>
+static void worker_sample (string& out, const char* name, uint64_t id, T val) {
+    out += METRIC_PREFIX;
+    out += name;
+    out += "{worker=\"";
+    append(out, id);
+    out += "\"} ";
+    append(out, val);
+    out += '\n';
+}
+
+MetricsServer::MetricsServer (const Mpm& mpm, const LoopSP& loop) : mpm(mpm), loop(loop) {}
+
+MetricsServer::~MetricsServer () {
+    if (server) server->stop();
+}
+
+void MetricsServer::start (const Server::Location& loc) {
+    Server::Config cfg;
+    cfg.locations.push_back(loc);
+    server = new Server(loop);
+    server->configure(cfg);
+    server->request_event.add([this](auto& req) { handle_request(req); });
+    server->run();
+    panda_log_info("metrics server started");
+}
+
+void MetricsServer::handle_request (const ServerRequestSP& req) {
+    req->respond(new ServerResponse(200, Headers().add("Content-Type", content_type), Body(render())));
+}
+
+string MetricsServer::render () const {
+    auto& workers  = mpm.get_worker_map();
+    auto& counters = mpm.get_counters();
+    auto& stats    = mpm.get_last_stats();
+    auto  now      = monotonic_ms();
+
+    string out;
+    out.reserve(last_size + last_size / 4);
+
+    header(out, "workers", "gauge", "Number of workers by state");
+    for (auto state : {Worker::State::starting, Worker::State::running, Worker::State::restarting, Worker::State::terminating, Worker::State::standby}) {
+        out += METRIC_PREFIX "workers{state=\"";
+        out += state_name(state);
+        out += "\"} ";
+        append(out, (uint64_t)mpm.count_workers(state));
+        out += '\n';
+    }
+
+    header(out, "load_average", "gauge", "Average loop load of starting and running workers as of the last check");
+    sample(out, "load_average", (double)stats.avgload);
+    header(out, "request_rate", "gauge", "Requests per second as of the last check");
+    sample(out, "request_rate", (double)stats.req_speed);
+    header(out, "spawns", "counter", "Workers spawned");
+    sample(out, "spawns_total", counters.spawned);
+    header(out, "restarts", "counter", "Workers restarted (max_requests, restart_workers, reconfigure)");
+    sample(out, "restarts_total", counters.restarted);
+    header(out, "kills", "counter", "Workers killed (not responding or not terminated in time)");
+    sample(out, "kills_total", counters.killed);
+    header(out, "spawn_latency_seconds", "summary", "Time from spawn to serving");
+    sample(out, "spawn_latency_seconds_sum", counters.spawn_latency_sum / 1000.0);
+    sample(out, "spawn_latency_seconds_count", counters.spawn_latency_count);
+
+    header(out, "worker_state", "gauge", "Worker state, 1 for the current one");
+    for (auto& row : workers) {
+        out += METRIC_PREFIX "worker_state{worker=\"";
+        append(out, row.first);
+        out += "\",state=\"";
+        out += state_name(row.second->state);
+        out += "\"} 1\n";
+    }
+
+    header(out, "worker_active_requests", "gauge", "Requests being processed by worker");
+    for (auto& row : workers) worker_sample(out, "worker_active_requests", row.first, (uint64_t)row.second->active_requests);
+    header(out, "worker_requests", "counter", "Requests served by worker");
+    for (auto& row : workers) worker_sample(out, "worker_requests_total", row.first, (uint64_t)row.second->total_requests);
+    header(out, "worker_recent_requests", "gauge", "Requests served by worker between the last two checks");
+    for (auto& row : workers) worker_sample(out, "worker_recent_requests", row.first, (uint64_t)row.second->recent_requests);
+    header(out, "worker_connections", "gauge", "Open connections of worker");
+    for (auto& row : workers) worker_sample(out, "worker_connections", row.first, (uint64_t)row.second->connections);
+    if (mpm.get_config().lag_probe_interval) {
+        header(out, "worker_loop_lag_p99_seconds", "gauge", "How late worker's lag probe fired since previous heartbeat, 99th percentile");
+        for (auto& row : workers) worker_sample(out, "worker_loop_lag_p99_seconds", row.first, row.second->loop_lag_p99 / 1e6);
+        header(out, "worker_loop_lag_max_seconds", "gauge", "The longest delay of worker's lag probe since previous heartbeat");
+        for (auto& row : workers) worker_sample(out, "worker_loop_lag_max_seconds", row.first, row.second->loop_lag_max / 1e6);
+    }
+    header(out, "worker_load_average", "gauge", "Loop load of worker");
+    for (auto& row : workers) worker_sample(out, "worker_load_average", row.first, (double)row.second->load_average);
+    header(out, "worker_memory_bytes", "gauge", "Resident memory of worker process or memory allocated by worker thread");
+    for (auto& row : workers) worker_sample(out, "worker_memory_bytes", row.first, row.second->memory);
+    header(out, "worker_memory_shared_bytes", "gauge", "Resident memory of worker process shared with other processes (prefork)");
+    for (auto& row : workers) if (row.second->memory_pss) worker_sample(out, "worker_memory_shared_bytes", row.first, row.second->memory_shared);
+    header(out, "worker_memory_private_bytes", "gauge", "Resident memory used only by worker process (prefork)");
+    for (auto& row : workers) if (row.second->memory_pss) worker_sample(out, "worker_memory_private_bytes", row.first, row.second->memory_private);
+    header(out, "worker_memory_pss_bytes", "gauge", "Proportional set size of worker process (prefork)");
+    for (auto& row : workers) if (row.second->memory_pss) worker_sample(out, "worker_memory_pss_bytes", row.first, row.second->memory_pss);
+    header(out, "worker_uptime_seconds", "gauge", "Time since worker was spawned");
+    for (auto& row : workers) worker_sample(out, "worker_uptime_seconds", row.first, (now - row.second->spawn_time) / 1000.0);
+    header(out, "worker_spawn_latency_seconds", "gauge", "Time from spawn to serving");
+    for (auto& row : workers) {
+        auto w = row.second.get();
+        if (w->ready_time) worker_sample(out, "worker_spawn_latency_seconds", row.first, (w->ready_time - w->spawn_time) / 1000.0);
+    }
+
+    out += "# EOF\n";
+    last_size = out.length();
+    return out;
+}
+
+}}}}
@@ -0,0 +1,29 @@
+#pragma once
+#include <panda/unievent/http/Server.h>
+
+namespace panda { namespace unievent { namespace http { namespace manager {
+
+struct Mpm;
+
+// serves OpenMetrics text exposition of manager's state on master loop. Requests are answered from master's own view of
+// workers (as of the last check), so scraping never involves workers and costs one buffer allocation per request.
+struct MetricsServer {
+    static constexpr const char* content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+    MetricsServer (const Mpm&, const LoopSP&);
+    ~MetricsServer ();
+
+    void start (const Server::Location&);
+
+    string render () const;
+
+private:
+    const Mpm& mpm;
+    LoopSP     loop;
+    ServerSP   server;
+    mutable size_t last_size = 4096;
+
+    void handle_request (const ServerRequestSP&);
+};
+
+}}}}
@@ -1,4 +1,5 @@
 #include "Mpm.h"
+#include "Metrics.h"
 #include "math.h"
 #include <iomanip>
 #include <panda/unievent/Fs.h>
@@ -31,6 +32,15 @@ static excepted<Mpm::Config, string> normalize_config (const Mpm::Config& _confi
     if (!config.max_load && !config.min_spare_servers) config.max_load = 0.7;
     if (!config.min_load && config.max_load) config.min_load = config.max_load / 2;
 
+    if (config.worker_model == Manager::WorkerModel::Hybrid) {
+        if (!config.threads_per_worker) {
+            config.threads_per_worker = std::max((size_t)1, panda::unievent::cpu_info().value().size() / config.max_servers);
+        }
+        if (config.standby_servers) {
+            return make_unexpected<string>("standby_servers are not supported with hybrid worker model");
+        }
+    }
+
     if (config.min_servers > config.max_servers) {
         return make_unexpected<string>("max_servers should be equal to or higher than min_servers");
     }
@@ -44,6 +54,40 @@ static excepted<Mpm::Config, string> normalize_config (const Mpm::Config& _confi
         return make_unexpected<string>("max_spare_servers should be equal to or lower than max_servers");
     }
 
+    if (config.target_load <= 0 || config.target_load > 1 || config.ewma_alpha <= 0 || config.ewma_alpha > 1) {
+        return make_unexpected<string>("target_load and ewma_alpha should be in range (0-1]");
+    }
+
+    if (config.target_p99_latency < 0 || config.latency_cooldown < 0) {
+        return make_unexpected<string>("target_p99_latency and latency_cooldown must not be negative");
+    }
+
+    if ((config.max_loop_lag || config.loop_stall_timeout) && !config.lag_probe_interval) {
+        return make_unexpected<string>("max_loop_lag and loop_stall_timeout require lag_probe_interval");
+    }
+
+    if (config.min_spare_connections && !config.max_connections_per_worker) {
+        return make_unexpected<string>("min_spare_connections requires max_connections_per_worker");
+    }
+
+    if (config.accept_mutex) {
+        if (config.worker_model != Manager::WorkerModel::PreFork) {
+            return make_unexpected<string>("accept_mutex is only supported with prefork worker model");
+        }
+        if (!config.accept_mutex_delay) return make_unexpected<string>("accept_mutex_delay must not be zero");
+        // workers recreate their listeners when taking turns, a reuse_port socket of their own would drop its queued connections
+        for (auto& loc : config.server.locations) {
+            if (loc.host && loc.reuse_port && !loc.sock && !config.per_worker_sockets) {
+                return make_unexpected<string>("accept_mutex requires per_worker_sockets for reuse_port locations");
+            }
+        }
+        if (!config.accept_max_load) config.accept_max_load = config.max_load ? config.max_load : 0.7;
+    }
+
+    if (config.affinity == Manager::Affinity::List && config.affinity_cpus.empty()) {
+        return make_unexpected<string>("affinity_cpus must not be empty for list affinity");
+    }
+
     if (!config.server.locations.size()) {
         return make_unexpected<string>("no listen addresses supplied");
     }
@@ -57,6 +101,7 @@ Mpm::Mpm (const Config& _config, const LoopSP& _loop, const LoopSP& _worker_loop
     auto res = normalize_config(_config);
     if (!res) throw exception(res.error());
     config = res.value();
+    scaling_policy = ScalingPolicy::create(config.scaling_model);
 }
 
 void Mpm::run () {
@@ -71,9 +116,20 @@ void Mpm::run () {
     check_termination_timer->start(config.check_interval * 1000);
     check_termination_timer->weak(true);
 
+    notify_timer = new Timer(loop);
+    notify_timer->event.add([this](auto&){
+        notify_pending = false;
+        check_workers();
+    });
+    notify_timer->weak(true);
+
+    preload_event();
+
     create_and_bind_sockets(config);
+    start_metrics();
 
     start_event();
+    started();
 
     panda_log_info("manager started with config:\n" << panda::log::prettify_json{config});
 
@@ -93,7 +149,7 @@ excepted<void, string> Mpm::create_and_bind_sockets (Config& config) {
             return make_unexpected<string>("windows named pipes not yet supported with http-manager");
         }
         #else
-        if (loc.path) {
+        if (loc.path && !loc.sock) { // hybrid worker process gets master's socket, it must not rebind the path
             unievent::Fs::unlink(loc.path).nevermind();
             auto res1 = unievent::socket(AF_UNIX, SOCK_STREAM, 0);
             if (!res1) return make_unexpected<string>(ErrorCode(res1.error()).what());
@@ -123,82 +179,175 @@ excepted<void, string> Mpm::create_and_bind_sockets (Config& config) {
     return {};
 }
 
-std::vector<Worker*> Mpm::get_workers (int states) {
-    std::vector<Worker*> ret;
-    for (auto& row : workers) {
-        if (!states || (states & (int)row.second->state)) ret.push_back(row.second.get());
-    }
-    return ret;
+void Mpm::start_metrics () {
+    auto& loc = config.metrics_location;
+    if (!loc.host && !loc.path && !loc.sock) return;
+    metrics = std::make_unique<MetricsServer>(*this, loop);
+    metrics->start(loc);
+}
+
+void WorkerList::push_back (Worker* w) {
+    w->list_prev = tail;
+    w->list_next = nullptr;
+    if (tail) tail->list_next = w;
+    else      head = w;
+    tail = w;
+    ++size;
+}
+
+void WorkerList::remove (Worker* w) {
+    if (w->list_prev) w->list_prev->list_next = w->list_next;
+    else              head = w->list_next;
+    if (w->list_next) w->list_next->list_prev = w->list_prev;
+    else              tail = w->list_prev;
+    w->list_prev = w->list_next = nullptr;
+    --size;
+}
+
+void Mpm::set_state (Worker* worker, Worker::State state) {
+    worker->state = state;
+    if (worker->listed == (int)state) return;
+    if (worker->listed) lists[list_index((Worker::State)worker->listed)].remove(worker);
+    lists[list_index(state)].push_back(worker);
+    worker->listed = (int)state;
 }
 
 void Mpm::check_workers () {
     fetch_state();
     kill_not_responding();
     terminate_restared_workers();
+    continue_restart();
     autorestart_workers();
 
-    struct {
-        uint32_t total    = 0;
-        uint32_t inactive = 0;
-    } cnt;
-
-    float sumload = 0;
+    ScalingPolicy::Stats cnt;
 
     uint64_t recent_requests = 0;
-    for (auto& row : workers) recent_requests += row.second->recent_requests;
+    latency.clear();
+    for (auto& row : workers) {
+        recent_requests += row.second->recent_requests;
+        latency.merge(row.second->latency);
+    }
     auto prev_time = last_check_time;
     loop->update_time();
     last_check_time = loop->now();
     float req_speed = recent_requests * 1000 / (last_check_time == prev_time ? 1 : last_check_time - prev_time);
+    cnt.req_speed = req_speed;
+    cnt.interval  = prev_time ? (last_check_time - prev_time) / 1000.0 : 0;
 
-    for (auto w : get_workers((int)Worker::State::starting | (int)Worker::State::running)) {
+    uint32_t lagging = 0;
+    for_each_worker((int)Worker::State::starting | (int)Worker::State::running, [&](Worker* w) {
+        cnt.loop_lag = std::max(cnt.loop_lag, w->loop_lag_p99 / 1000.0f);
+        if (config.max_loop_lag && w->loop_lag_p99 > config.max_loop_lag * 1000) ++lagging;
         ++cnt.total;
-        sumload += w->load_average;
+        cnt.sumload += w->load_average;
+        cnt.connections += w->connections;
         if (!w->active_requests) ++cnt.inactive;
-    }
+    });
 
-    float avgload = cnt.total ? sumload / cnt.total : 0;
+    float avgload = cnt.avgload = cnt.total ? cnt.sumload / cnt.total : 0;
+    cnt.p99_latency = latency.percentile(0.99) / 1000.0;
 
     ++check_count;
     panda_log(check_count % 60 == 0 ? log::Level::Info : log::Level::Debug,
         "servers total=" << cnt.total <<
         ", inactive=" << cnt.inactive <<
+        ", connections=" << cnt.connections <<
+        ", loop lag=" << std::setprecision(1) << std::fixed << cnt.loop_lag << "ms" <<
         ", load average=" << std::setprecision(3) << std::fixed << avgload <<
         ", reqs=" << std::setprecision(req_speed > 10 ? 0 : 1) << std::fixed << req_speed << " reqs/s"
     );
+    if (latency.count) panda_log_debug(
+        "request latency p50=" << std::setprecision(3) << std::fixed << latency.percentile(0.5) / 1000.0 <<
+        "ms p90=" << latency.percentile(0.9) / 1000.0 <<
+        "ms p99=" << latency.percentile(0.99) / 1000.0 <<
+        "ms p999=" << latency.percentile(0.999) / 1000.0 << "ms"
+    );
 
-    // first check if we have too few workers
-    uint32_t needed[] = {0,0,0};
-    uint32_t max_to_spawn = config.max_servers - cnt.total;
+    last_stats = cnt;
+    checked(cnt);
+    scale(cnt, lagging);
+    stats_event(cnt); // after spawning and terminating, listeners may stop or reconfigure manager
+}
 
-    if (cnt.total < config.min_servers)          needed[0] = config.min_servers - cnt.total;
-    if (cnt.inactive < config.min_spare_servers) needed[1] = config.min_spare_servers - cnt.inactive;
-    if (avgload > config.max_load)               needed[2] = ceil(sumload / config.max_load) - cnt.total;
+void Mpm::scale (const ScalingPolicy::Stats& cnt, uint32_t lagging) {
+    int64_t decision = scaling_policy->decide(config, cnt);
+
+    if (config.target_p99_latency) {
+        auto target = config.target_p99_latency;
+        if (cnt.p99_latency > target) {
+            // proportionally to the excess, but at most doubling per check as tail latency is noisy
+            int64_t wanted = ceil(cnt.total * (cnt.p99_latency - target) / target);
+            wanted = std::max<int64_t>(1, std::min<int64_t>(wanted, cnt.total));
+            if (wanted > decision) {
+                panda_log_debug("p99 latency " << cnt.p99_latency << "ms is above target, wants " << wanted << " more servers");
+                decision = wanted;
+            }
+            latency_low_since = 0;
+        }
+        else if (cnt.p99_latency > target / 2) {
+            decision = std::max<int64_t>(decision, 0); // near target, keep workers
+            latency_low_since = 0;
+        }
+        else {
+            if (!latency_low_since) latency_low_since = last_check_time;
+            if (last_check_time - latency_low_since < config.latency_cooldown * 1000) {
+                decision = std::max<int64_t>(decision, 0);
+            }
+            else if (!decision && cnt.total > config.min_servers) {
+                // one worker per cooldown, unless the rest would be overloaded
+                if (cnt.total > 1 && (!config.max_load || cnt.sumload / (cnt.total - 1) <= config.max_load)) {
+                    decision = -1;
+                    latency_low_since = last_check_time;
+                }
+            }
+        }
+    }
 
-    uint32_t cnt_to_spawn = std::min(max_to_spawn, std::max({needed[0], needed[1], needed[2]}));
+    // a stalled loop delays all its connections, take load off lagging workers and keep them.
+    // Lag persists until new workers start and take connections, so spawn once per latency_cooldown
+    if (lagging) {
+        if ((!lag_spawn_time || last_check_time - lag_spawn_time >= config.latency_cooldown * 1000) && lagging > decision) {
+            panda_log_debug(lagging << " servers have loop lag above " << config.max_loop_lag << "ms");
+            decision = lagging;
+            lag_spawn_time = last_check_time;
+        }
+        else decision = std::max<int64_t>(decision, 0);
+    }
 
+    // keep capacity for open connections: spawn when it runs out and don't terminate workers the rest couldn't replace
+    if (config.max_connections_per_worker) {
+        int64_t needed = (cnt.connections + config.min_spare_connections + config.max_connections_per_worker - 1) / config.max_connections_per_worker;
+        if (needed - (int64_t)cnt.total > decision) {
+            panda_log_debug("connections " << cnt.connections << " need " << needed << " servers");
+            decision = needed - cnt.total;
+        }
+    }
+
+    // min_servers and max_servers are hard limits regardless of policy
+    int64_t max_to_spawn = (int64_t)config.max_servers - cnt.total;
+    int64_t max_to_term  = (int64_t)cnt.total - config.min_servers;
+    if (cnt.total < config.min_servers) decision = std::max<int64_t>(decision, config.min_servers - cnt.total);
+    if (cnt.total > config.max_servers) decision = std::min<int64_t>(decision, max_to_spawn);
 
-    if (cnt_to_spawn) {
-        panda_log_debug("needed by: min_servers=" << needed[0] << " min_spare_servers=" << needed[1] << " max_load=" << needed[2] << ". Allowed by max_servers " << max_to_spawn << " more");
+    if (decision > 0) {
+        uint32_t cnt_to_spawn = std::max<int64_t>(0, std::min<int64_t>(decision, max_to_spawn));
+        if (!cnt_to_spawn) return replenish_standby();
+        panda_log_debug("policy wants " << decision << " more servers. Allowed by max_servers " << max_to_spawn << " more");
         panda_log_info("adding " << cnt_to_spawn << " more servers");
         for (size_t i = 0; i < cnt_to_spawn; ++i) spawn();
+        replenish_standby();
         return;
     }
 
-    // now check if we have too many workers
-    uint32_t wanted[3] = {0,0,0};
-    if (cnt.total > config.max_servers)                                      wanted[0] = cnt.total - config.max_servers;
-    if (config.max_spare_servers && cnt.inactive > config.max_spare_servers) wanted[1] = cnt.inactive - config.max_spare_servers;
-    if (config.min_load && avgload < config.min_load)                        wanted[2] = cnt.total - uint32_t(sumload / config.min_load);
-
-    uint32_t max_to_term = cnt.total - config.min_servers;
-    uint32_t cnt_to_term = std::min(max_to_term, std::max({wanted[0], wanted[1], wanted[2]}));
-
-    if (cnt_to_term) {
-        panda_log_debug("wanted to terminate by: max_servers=" << wanted[0] << " max_spare_servers=" << wanted[1] << " min_load=" << wanted[2] << ". Allowed by min_servers " << max_to_term);
+    if (decision < 0) {
+        uint32_t cnt_to_term = std::min<int64_t>(-decision, max_to_term);
+        if (!cnt_to_term) return replenish_standby();
+        panda_log_debug("policy wants to terminate " << -decision << " servers. Allowed by min_servers " << max_to_term);
         panda_log_info("terminating " << cnt_to_term << " servers");
         terminate_workers(cnt_to_term);
     }
+
+    replenish_standby();
 }
 
 void Mpm::fetch_state () {
@@ -206,44 +355,47 @@ void Mpm::fetch_state () {
         auto worker = row.second.get();
         worker->fetch_state();
         // worker is ready when it first sends activity stats
-        if (worker->state == Worker::State::starting && worker->activity_time) worker->state = Worker::State::running;
+        if (worker->state == Worker::State::starting && worker->activity_time) set_running(worker);
     }
 }
 
+void Mpm::set_running (Worker* worker) {
+    set_state(worker, Worker::State::running);
+    worker->ready_time = monotonic_ms();
+    counters.spawn_latency_sum += worker->ready_time - worker->spawn_time;
+    ++counters.spawn_latency_count;
+}
+
 void Mpm::kill_not_responding () {
-    if (!config.activity_timeout) return;
-    auto now = std::time(NULL);
-    for (auto w : get_workers(Worker::State::running)) {
-        if (now - w->activity_time < config.activity_timeout) continue;
-        panda_log_alert("killing not responding worker id=" << w->id);
-        kill_worker(w);
-    }
+    if (!config.activity_timeout && !config.loop_stall_timeout) return;
+    auto now = monotonic_ms();
+    for_each_worker(Worker::State::running, [&](Worker* w) {
+        if (config.activity_timeout && now - w->activity_time >= config.activity_timeout * 1000) {
+            panda_log_alert("killing not responding worker id=" << w->id);
+            kill_worker(w);
+        }
+        else if (config.loop_stall_timeout && w->probe_time && now - w->probe_time >= config.loop_stall_timeout * 1000) {
+            panda_log_alert("killing worker id=" << w->id << " with loop stalled for " << now - w->probe_time << "ms");
+            kill_worker(w);
+        }
+    });
 }
 
 void Mpm::kill_not_terminated () {
     if (!config.termination_timeout) return;
-    auto now = std::time(NULL);
-    for (auto w : get_workers(Worker::State::terminating)) {
-        if (now - w->termination_time < config.termination_timeout) continue;
+    auto now = monotonic_ms();
+    for_each_worker(Worker::State::terminating, [&](Worker* w) {
+        if (now - w->termination_time < config.termination_timeout * 1000) return;
         panda_log_info("killing not terminated worker id=" << w->id);
         kill_worker(w);
-    }
+    });
 }
 
 void Mpm::terminate_restared_workers () {
-    // find the first and the last worker in chain "restarting" -> "restarting" -> ... -> "starting/running"
-    // terminate all the chain if the last worker is running
-    auto list = get_workers(Worker::State::restarting);
-
-    std::map<uint64_t, Worker*> replaced_by_index;
-    for (auto w : list) {
+    // chain "restarting" -> "restarting" -> ... -> "starting/running": each restarting worker is terminated when the last worker
+    // of its chain is running. Only the visited worker changes state, so the rest of the chain is still visited afterwards
+    for_each_worker(Worker::State::restarting, [this](Worker* w) {
         assert(w->replaced_by);
-        assert(!replaced_by_index.count(w->replaced_by));
-        replaced_by_index[w->replaced_by] = w;
-    }
-
-    for (auto w : list) {
-        if (replaced_by_index.count(w->id)) continue;
         auto last = w;
         while (last->replaced_by) {
             auto it = workers.find(last->replaced_by);
@@ -255,88 +407,266 @@ void Mpm::terminate_restared_workers () {
             last = it->second.get();
         }
 
-        if (last->state == Worker::State::starting) continue;
-        assert(last->state == Worker::State::running);
+        if (last->state != Worker::State::running) return;
+        panda_log_info("restarting worker id=" << w->id << " complete");
+        terminate_worker(w);
+    });
+}
 
-        panda_log_info("restarting worker complete");
-        auto curw = w;
-        while (curw != last) {
-            assert(curw->state == Worker::State::restarting);
-            auto nextid = curw->replaced_by;
-            terminate_worker(curw);
-            curw = workers.at(nextid).get();
+void Mpm::autorestart_workers () {
+    if (!config.max_requests && !config.max_worker_rss) return;
+    auto now = monotonic_ms();
+    for_each_worker(Worker::State::running, [&](Worker* w) {
+        if (now - w->creation_time <= config.min_worker_ttl * 1000) return;
+        if (config.max_requests && w->total_requests >= config.max_requests) {
+            panda_log_notice("worker id=" << w->id << " max requests reached, restarting...");
+            restart_worker(w);
         }
-    }
+        else if (config.max_worker_rss && w->memory > config.max_worker_rss) {
+            panda_log_notice("worker id=" << w->id << " uses " << w->memory << " bytes of memory, more than max_worker_rss, restarting...");
+            restart_worker(w);
+        }
+    });
 }
 
-void Mpm::autorestart_workers () {
-    if (!config.max_requests) return;
-    auto now = std::time(NULL);
-    for (auto w : get_workers(Worker::State::running)) {
-        if (w->total_requests < config.max_requests || now - w->creation_time <= config.min_worker_ttl) continue;
-        panda_log_notice("worker id=" << w->id << " max requests reached, restarting...");
-        restart_worker(w);
-    }
+Worker* Mpm::spawn (const Worker* replaced) {
+    if (auto w = activate_standby()) return w;
+    return spawn_worker(false, replaced);
 }
 
-Worker* Mpm::spawn () {
-    panda_log_debug("spawning worker");
-    auto worker = create_worker();
+Worker* Mpm::spawn_worker (bool standby, const Worker* replaced) {
+    panda_log_debug("spawning " << (standby ? "standby " : "") << "worker");
+    WorkerParams params;
+    params.standby = standby;
+    if (config.affinity != Manager::Affinity::None) params.placement_slot = acquire_placement_slot(replaced ? replaced->placement_slot : -1);
+    int32_t listen_slot = -1;
+    if (config.per_worker_sockets) {
+        listen_slot = acquire_listen_slot(replaced ? replaced->listen_slot : -1);
+        if (listen_slot >= 0) params.listen_socks = listen_slots[listen_slot].socks;
+    }
+
+    WorkerPtr worker;
+    try {
+        worker = create_worker(params);
+    } catch (RunChildInOuterScope&) {
+        throw; // forked child, master's state is already released there
+    } catch (...) {
+        release_placement_slot(params.placement_slot);
+        release_listen_slot(listen_slot, true); // sockets are left for the next attempt
+        throw;
+    }
     auto wptr = worker.get();
+    worker->placement_slot = params.placement_slot;
+    worker->listen_slot    = listen_slot;
     worker->id = ++lastid;
-    worker->creation_time = std::time(NULL);
+    worker->creation_time = monotonic_ms();
+    worker->spawn_time    = worker->creation_time;
     worker->activity_time = worker->creation_time;
+    ++counters.spawned;
+    if (standby) worker->activity_time = 0; // becomes ready for activation when it first sends activity stats
     workers[worker->id] = std::move(worker);
+    set_state(wptr, standby ? Worker::State::standby : Worker::State::starting);
     return wptr;
 }
 
+Worker* Mpm::activate_standby () {
+    auto& standby = lists[list_index(Worker::State::standby)];
+    for (auto w = standby.head; w; w = w->list_next) {
+        if (!w->activity_time) continue; // still initializing
+        panda_log_debug("activating standby worker id=" << w->id);
+        set_state(w, Worker::State::running); // it is already initialized, so it serves right after activation
+        w->creation_time = monotonic_ms();
+        w->activate();
+        return w;
+    }
+    return nullptr;
+}
+
+void Mpm::replenish_standby () {
+    size_t standby = count_workers(Worker::State::standby);
+    uint32_t active = count_workers(Worker::State::starting) + count_workers(Worker::State::running);
+    uint32_t wanted = active < config.max_servers ? std::min(config.standby_servers, config.max_servers - active) : 0;
+
+    if (standby > wanted) {
+        panda_log_debug("terminating " << (standby - wanted) << " unneeded standby servers");
+        size_t i = 0;
+        for_each_worker(Worker::State::standby, [&](Worker* w) {
+            if (i++ >= wanted) terminate_worker(w);
+        });
+        return;
+    }
+    for (auto i = standby; i < wanted; ++i) spawn_worker(true);
+}
+
 void Mpm::terminate_workers (uint32_t cnt) {
     if (!cnt) return;
-    auto now = std::time(NULL);
-    std::vector<Worker*> victims;
-    for (auto& row : workers) {
-        auto w = row.second.get();
-        if (w->state == Worker::State::running && now - w->creation_time >= config.min_worker_ttl) {
-            victims.push_back(w);
-        }
-    }
+    auto now = monotonic_ms();
+    victims.clear();
+    for_each_worker(Worker::State::running, [&](Worker* w) {
+        if (now - w->creation_time >= config.min_worker_ttl * 1000) victims.push_back(w);
+    });
     panda_log_info("want to terminate " << cnt << " servers, allowed to terminate " << victims.size() << " servers");
 
-    std::sort(victims.begin(), victims.end(), [](auto a, auto b) { return a->total_requests > b->total_requests; });
+    switch (config.victim_selection) {
+        case Manager::VictimSelection::MostRequests:
+            std::sort(victims.begin(), victims.end(), [](auto a, auto b) { return a->total_requests > b->total_requests; });
+            break;
+        case Manager::VictimSelection::DrainCost:
+            // graceful stop waits for active requests and open connections, busy worker's clients would also see a latency hit.
+            // among equally cheap ones the most used worker is recycled
+            std::sort(victims.begin(), victims.end(), [](auto a, auto b) {
+                if (a->active_requests != b->active_requests) return a->active_requests < b->active_requests;
+                if (a->connections != b->connections) return a->connections < b->connections;
+                if (a->load_average != b->load_average) return a->load_average < b->load_average;
+                return a->total_requests > b->total_requests;
+            });
+            break;
+    }
 
     for (uint32_t i = 0; i < cnt && i < victims.size(); ++i) terminate_worker(victims[i]);
+    victims.clear();
 }
 
 void Mpm::terminate_worker (Worker* worker) {
-    worker->state = Worker::State::terminating;
-    worker->termination_time = std::time(NULL);
+    set_state(worker, Worker::State::terminating);
+    release_listen_slot(worker->listen_slot, false); // worker stops listening, nobody would accept connections queued on its sockets
+    worker->termination_time = monotonic_ms();
     worker->terminate();
 }
 
 void Mpm::kill_worker (Worker* worker) {
-    worker->state = Worker::State::terminating;
+    ++counters.killed;
+    set_state(worker, Worker::State::terminating);
+    release_listen_slot(worker->listen_slot, true);
     worker->kill();
 }
 
 Worker* Mpm::restart_worker (Worker* worker) {
-    auto restarting_worker = spawn();
-    worker->state = Worker::State::restarting;
+    auto restarting_worker = spawn(worker); // takes over worker's cpu and sockets
+    ++counters.restarted;
+    set_state(worker, Worker::State::restarting);
     worker->replaced_by = restarting_worker->id;
     return restarting_worker;
 }
 
+void Mpm::worker_ready (Worker* worker) {
+    // worker has sent its first activity stats, no need to wait for the next check to count it as running
+    if (worker->state != Worker::State::starting) return;
+    set_running(worker);
+    worker->activity_time = worker->ready_time;
+    notified(); // restart handover and spare accounting can proceed right away
+}
+
+void Mpm::notified () {
+    if (state != State::running || !config.notify_interval || notify_pending) return;
+    // rate-limited: a burst of notifications from many workers results in a single check
+    loop->update_time();
+    auto elapsed = loop->now() - last_check_time;
+    if (elapsed >= config.notify_interval) {
+        check_workers();
+        return;
+    }
+    notify_pending = true;
+    notify_timer->once(config.notify_interval - elapsed);
+}
+
+int32_t Mpm::acquire_placement_slot (int32_t shared) {
+    if (shared >= 0 && (size_t)shared < placement_slots.size() && placement_slots[shared]) {
+        ++placement_slots[shared];
+        return shared;
+    }
+    for (size_t i = 0; i < placement_slots.size(); ++i) {
+        if (placement_slots[i]) continue;
+        placement_slots[i] = 1;
+        return i;
+    }
+    placement_slots.push_back(1);
+    return placement_slots.size() - 1;
+}
+
+void Mpm::release_placement_slot (int32_t slot) {
+    if (slot >= 0 && (size_t)slot < placement_slots.size() && placement_slots[slot]) --placement_slots[slot];
+}
+
+int32_t Mpm::acquire_listen_slot (int32_t shared) {
+    if (shared >= 0 && (size_t)shared < listen_slots.size() && listen_slots[shared].socks.size()) {
+        ++listen_slots[shared].users;
+        return shared;
+    }
+
+    // orphaned slot first, connections are waiting in its queues
+    int32_t id = -1;
+    for (size_t i = 0; i < listen_slots.size(); ++i) {
+        auto& slot = listen_slots[i];
+        if (slot.users) continue;
+        if (slot.socks.size()) {
+            id = i;
+            break;
+        }
+        if (id < 0) id = i;
+    }
+    if (id < 0) {
+        id = listen_slots.size();
+        listen_slots.emplace_back();
+    }
+
+    auto& slot = listen_slots[id];
+    if (slot.socks.empty()) {
+        for (auto& loc : config.server.locations) {
+            if (!Child::per_worker(config, loc)) continue;
+            auto res = bind_reuse_port_socket(loop, loc);
+            if (!res) {
+                panda_log_error("could not bind socket for worker, it will bind its own: " << res.error());
+                close_listen_slot(slot);
+                return -1;
+            }
+            slot.socks.push_back(res.value());
+        }
+    }
+    ++slot.users;
+    return id;
+}
+
+void Mpm::release_listen_slot (int32_t& id, bool keep) {
+    if (id < 0) return;
+    auto& slot = listen_slots[id];
+    id = -1;
+    if (--slot.users || keep) return;
+    close_listen_slot(slot);
+}
+
+void Mpm::close_listen_slot (ListenSlot& slot) {
+    for (auto sock : slot.socks) close_socket(sock);
+    slot.socks.clear();
+}
+
+void Mpm::close_orphaned_listen_slots () {
+    for (auto& slot : listen_slots) if (!slot.users) close_listen_slot(slot);
+}
+
+void Mpm::close_listen_slots () {
+    for (auto& slot : listen_slots) close_listen_slot(slot);
+    listen_slots.clear();
+    for (auto& row : workers) row.second->listen_slot = -1;
+}
+
 void Mpm::worker_terminated (Worker* worker) {
+    release_placement_slot(worker->placement_slot);
+    release_listen_slot(worker->listen_slot, true); // died unexpectedly, the worker spawned instead takes over its sockets
     switch (worker->state) {
         case Worker::State::starting    : panda_log_critical("starting worker died"); break;
         case Worker::State::restarting  :
         case Worker::State::running     : panda_log_critical("running worker died"); break;
+        case Worker::State::standby     : panda_log_critical("standby worker died"); break;
         case Worker::State::terminating : panda_log_info("worker terminated");
     }
+    if (worker->listed) lists[list_index((Worker::State)worker->listed)].remove(worker);
     workers.erase(worker->id);
 
     switch (state) {
         case State::running : {
             check_workers();
+            close_orphaned_listen_slots(); // not taken over
             break;
         }
         case State::stopping : {
@@ -354,25 +684,27 @@ void Mpm::stop () {
     panda_log_info("server is stopping...");
     state = State::stopping;
     check_timer.reset();
+    notify_timer.reset();
+    metrics.reset();
+    rolling.queue.clear();
+    rolling.in_flight.clear();
+    rolling.total = 0;
 
     // we need to close all sockets we've created
     for (auto& loc : config.server.locations) {
         if (loc.sock) close_socket(loc.sock.value());
     }
+    close_listen_slots(); // workers have their own copies
 
     if (!workers.size()) {
         stopped();
         return;
     }
 
-    for (auto& worker : get_workers()) {
-        switch (worker->state) {
-            case Worker::State::starting    :
-            case Worker::State::restarting  :
-            case Worker::State::running     : terminate_worker(worker); break;
-            default : break;
-        }
-    }
+    for_each_worker(
+        (int)Worker::State::starting | (int)Worker::State::running | (int)Worker::State::restarting | (int)Worker::State::standby,
+        [this](Worker* w) { terminate_worker(w); }
+    );
 }
 
 void Mpm::close_socket (sock_t sock) {
@@ -388,16 +720,87 @@ void Mpm::stopped () {
     loop->stop();
 }
 
+Manager::Stats Mpm::stats () const {
+    Manager::Stats ret;
+    ret.last_check = last_stats;
+    ret.counters   = counters;
+    ret.workers.reserve(workers.size());
+    for (auto& row : workers) {
+        auto w = row.second.get();
+        Manager::WorkerStats ws;
+        ws.id              = w->id;
+        ws.system_id       = w->system_id();
+        ws.state           = w->state;
+        ws.active_requests = w->active_requests;
+        ws.connections     = w->connections;
+        ws.total_requests  = w->total_requests;
+        ws.recent_requests = w->recent_requests;
+        ws.load_average    = w->load_average;
+        ws.loop_lag_max    = w->loop_lag_max;
+        ws.loop_lag_p99    = w->loop_lag_p99;
+        ws.memory          = w->memory;
+        ws.memory_pss      = w->memory_pss;
+        ws.memory_shared   = w->memory_shared;
+        ws.memory_private  = w->memory_private;
+        ws.spawn_time      = w->spawn_time;
+        ws.creation_time   = w->creation_time;
+        ws.ready_time      = w->ready_time;
+        ws.activity_time   = w->activity_time;
+        ret.workers.push_back(std::move(ws));
+    }
+    return ret;
+}
+
 void Mpm::restart_workers () {
     loop->delay([this]{ restart_all_workers(); });
 }
 
 void Mpm::restart_all_workers () {
     panda_log_notice("restarting all workers");
-    for (auto& worker : get_workers((int)Worker::State::starting | (int)Worker::State::running)) {
+    // standby workers were initialized with the old config, replenish_standby() will create new ones
+    for_each_worker(Worker::State::standby, [this](Worker* w) { terminate_worker(w); });
+    rolling.queue.clear();
+    for_each_worker((int)Worker::State::starting | (int)Worker::State::running, [this](Worker* w) { rolling.queue.push_back(w->id); });
+    rolling.total    = rolling.queue.size() + rolling.in_flight.size(); // previous restart is merged into the new one
+    rolling.reported = 0;
+    if (!rolling.total) {
+        restart_event(0, 0);
+        return;
+    }
+    continue_restart();
+}
+
+void Mpm::continue_restart () {
+    if (!rolling.total) return;
+
+    // replacement has started serving and old worker is terminated by terminate_restared_workers()
+    auto& in_flight = rolling.in_flight;
+    in_flight.erase(std::remove_if(in_flight.begin(), in_flight.end(), [this](auto id) {
+        auto it = workers.find(id);
+        return it == workers.end() || it->second->state != Worker::State::restarting;
+    }), in_flight.end());
+
+    while (!rolling.queue.empty() && (!config.max_surge || in_flight.size() < config.max_surge)) {
+        auto it = workers.find(rolling.queue.front());
+        rolling.queue.pop_front();
+        if (it == workers.end()) continue; // died meanwhile, regular scaling takes care of it
+        auto worker = it->second.get();
+        if (worker->state != Worker::State::starting && worker->state != Worker::State::running) continue;
         auto new_worker = restart_worker(worker);
         new_worker->creation_time = worker->creation_time; // this is unplanned restart - preserve creation time to allow drop if limits reached
+        in_flight.push_back(worker->id);
     }
+
+    uint32_t replaced = rolling.total - rolling.queue.size() - in_flight.size();
+    if (replaced == rolling.reported && replaced != rolling.total) return;
+    rolling.reported = replaced;
+    auto total = rolling.total;
+    if (replaced == total) {
+        panda_log_notice("all workers restarted");
+        rolling.total = 0;
+    }
+    else panda_log_info("restarted " << replaced << " of " << total << " workers");
+    restart_event(replaced, total);
 }
 
 excepted<void, string> Mpm::reconfigure (const Config& _newcfg) {
@@ -410,7 +813,8 @@ excepted<void, string> Mpm::reconfigure (const Config& _newcfg) {
     }
 
     auto need_restart = (
-        config.server != newcfg.server || config.load_average_period != newcfg.load_average_period || config.check_interval != newcfg.check_interval
+        config.server != newcfg.server || config.load_average_period != newcfg.load_average_period || config.check_interval != newcfg.check_interval ||
+        config.per_worker_sockets != newcfg.per_worker_sockets || config.accept_mutex != newcfg.accept_mutex
     );
 
     if (need_restart) {
@@ -445,16 +849,26 @@ excepted<void, string> Mpm::reconfigure (const Config& _newcfg) {
 
         auto res = create_and_bind_sockets(newcfg);
         if (!res) return res;
+
+        close_listen_slots(); // bound for old locations, replacements of current workers get new ones
     }
 
     check_timer->stop();
     check_termination_timer->stop();
 
+    if (config.scaling_model != newcfg.scaling_model) scaling_policy = ScalingPolicy::create(newcfg.scaling_model);
+    auto metrics_changed = !(config.metrics_location == newcfg.metrics_location);
+
     config = newcfg;
     panda_log_info("manager reconfigured with config:\n" << panda::log::prettify_json{config});
 
     // we must call spawn() only from pure loop code flow because of prefork child specific run-in-outer-loop exception
-    loop->delay([this, need_restart] {
+    loop->delay([this, need_restart, metrics_changed] {
+        if (metrics_changed) {
+            metrics.reset();
+            start_metrics();
+        }
+        reconfigured();
         if (need_restart) restart_all_workers();
 
         check_timer->start(config.check_interval * 1000);
@@ -1,53 +1,116 @@
 #pragma once
 #include "Child.h"
 #include "Manager.h"
+#include "Histogram.h"
+#include "ScalingPolicy.h"
 #include <time.h>
+#include <deque>
 #include <memory>
+#include <unordered_map>
 #include <panda/unievent/http/Server.h>
 
 namespace panda { namespace unievent { namespace http { namespace manager {
 
 struct Worker {
-    enum class State { starting = 1, running = 2, restarting = 4, terminating = 8 };
+    using State = Manager::WorkerState;
     uint64_t id;
     State    state = State::starting;
-    time_t   creation_time;
-    time_t   activity_time;
+    uint64_t creation_time;            // monotonic_ms(), preserved on unplanned restart for min_worker_ttl
+    uint64_t spawn_time       = 0;     // monotonic_ms() when actually spawned
+    uint64_t ready_time       = 0;     // monotonic_ms() when started serving, 0 if not yet (or activated from standby)
+    uint64_t activity_time;            // last heartbeat, monotonic_ms(), 0 if not yet initialized
     size_t   active_requests  = 0;
+    size_t   connections      = 0;     // open connections, if reported by worker
     size_t   total_requests   = 0;
     size_t   recent_requests  = 0;
     float    load_average     = 0;
+    uint32_t loop_lag_max     = 0;     // us, the longest delay of worker's lag probe since previous heartbeat
+    uint32_t loop_lag_p99     = 0;
+    uint64_t probe_time       = 0;     // monotonic_ms() of the last lag probe, 0 if not probing
+    uint64_t memory           = 0;     // bytes, resident memory of process or allocated by thread (see max_worker_rss)
+    uint64_t memory_pss       = 0;     // prefork only, see Manager::Config::memory_details_interval
+    uint64_t memory_shared    = 0;
+    uint64_t memory_private   = 0;
+    Histogram latency;                 // request durations since previous fetch_state()
     uint64_t replaced_by      = 0;
-    time_t   termination_time = 0;
+    int32_t  placement_slot   = -1;    // cpu placement (see Placement), -1 if affinity is disabled
+    int32_t  listen_slot      = -1;    // see Mpm::ListenSlot, -1 if worker binds its own reuse_port sockets or has released the slot
+    uint64_t termination_time = 0;
+
+    virtual string system_id () const { return {}; } // pid or thread id
 
     virtual void fetch_state () = 0;
     virtual void terminate   () = 0;
     virtual void kill        () = 0;
+    virtual void activate    () = 0; // start serving, only for standby worker
 
     virtual ~Worker () {}
+
+private:
+    friend struct WorkerList;
+    friend struct Mpm;
+    Worker* list_prev = nullptr; // siblings in Mpm's list of workers in the same state
+    Worker* list_next = nullptr;
+    int     listed    = 0;       // state of the list the worker is linked into, 0 if none
 };
 
 using WorkerPtr = std::unique_ptr<Worker>;
-using Workers   = std::map<uint64_t, WorkerPtr>;
+using Workers   = std::unordered_map<uint64_t, WorkerPtr>;
+
+// intrusive list of workers in one state, moving worker between states doesn't allocate
+struct WorkerList {
+    Worker* head = nullptr;
+    Worker* tail = nullptr;
+    size_t  size = 0;
+
+    void push_back (Worker*);
+    void remove    (Worker*);
+};
+
+struct WorkerParams {
+    bool    standby        = false; // initialize but don't serve until Worker::activate()
+    int32_t placement_slot = -1;
+    std::vector<sock_t> listen_socks; // per_worker_sockets: owned by master, worker gets its own copies (see Child::use_listen_socks)
+};
+
+// thrown by a forked child through master's call stack, so that it runs outside of master's loop (see PreFork::run)
+struct RunChildInOuterScope {
+    std::unique_ptr<Child> child;
+};
+
+struct MetricsServer;
 
 struct Mpm {
     using Config = Manager::Config;
 
+    using Counters = Manager::Counters;
+
     Manager::server_factory_fn server_factory;
+    Manager::start_cd          preload_event;
     Manager::start_cd          start_event;
     Manager::spawn_cd          spawn_event;
     Manager::request_cd        request_event;
+    Manager::stats_cd          stats_event;
+    Manager::restart_cd        restart_event;
 
     Mpm (const Config&, const LoopSP&, const LoopSP&);
 
     const LoopSP& get_loop   () const { return loop; }
     const Config& get_config () const { return config; }
 
+    const Workers&              get_worker_map () const { return workers; }
+    const Counters&             get_counters   () const { return counters; }
+    const ScalingPolicy::Stats& get_last_stats () const { return last_stats; } // aggregates computed by the last check
+
+    size_t count_workers (Worker::State state) const { return lists[list_index(state)].size; }
+
     virtual void run  ();
     virtual void stop ();
 
     virtual void restart_workers ();
 
+    Manager::Stats stats () const;
+
     virtual excepted<void, string> reconfigure (const Config&);
 
     virtual ~Mpm ();
@@ -60,33 +123,112 @@ protected:
     State    state = State::initial;
     TimerSP  check_timer;
     TimerSP  check_termination_timer;
+    TimerSP  notify_timer;
     Workers  workers;
     uint64_t last_check_time = 0;
     uint64_t check_count = 0;
-
-    virtual WorkerPtr create_worker     () = 0;
+    uint64_t latency_low_since = 0; // target_p99_latency: loop time since p99 is well below target, 0 if it's not
+    uint64_t lag_spawn_time    = 0; // max_loop_lag: loop time of the last spawn for lagging workers
+    bool     notify_pending = false;
+    Histogram latency; // request durations of all workers since previous check
+    ScalingPolicyPtr scaling_policy;
+    std::vector<uint32_t> placement_slots; // workers per slot, replacement of restarted worker shares its slot
+    Counters counters;
+    ScalingPolicy::Stats last_stats;
+    std::unique_ptr<MetricsServer> metrics;
+    WorkerList lists[5];          // by state, see list_index()
+
+    // per_worker_sockets: master's copies of sockets which a worker listens on. Replacement of restarted worker shares the slot,
+    // slot of died or killed worker is kept for the worker spawned instead, so connections queued on its sockets are not reset
+    struct ListenSlot {
+        std::vector<sock_t> socks;     // one per reuse_port location, empty if closed
+        uint32_t            users = 0; // workers which are not yet terminating
+    };
+    std::vector<ListenSlot> listen_slots;
+    std::vector<Worker*> victims; // scratch for terminate_workers()
+
+    struct {
+        std::deque<uint64_t>  queue;     // ids of workers waiting to be replaced
+        std::vector<uint64_t> in_flight; // ids of workers being replaced
+        uint32_t              total    = 0; // 0 if no restart is in progress
+        uint32_t              reported = 0;
+    } rolling;
+
+    virtual WorkerPtr create_worker     (const WorkerParams&) = 0;
     void              worker_terminated (Worker*);
+    void              worker_ready      (Worker*);
+    void              notified          (); // worker has pushed a state change, check workers soon
     virtual void      stopped           ();
+    virtual void      started           () {} // after start_event, before first check
+    virtual void      reconfigured      () {} // new config applied, before restarting workers
+    virtual void      checked           (const ScalingPolicy::Stats&) {} // worker states fetched and aggregated
+
+    excepted<void, string> create_and_bind_sockets (Config&);
+
+    void set_state (Worker*, Worker::State); // the only way to change worker's state, keeps lists in sync
+
+    // calls fn once for each worker which is in one of the states when called. fn may change state of the worker it receives,
+    // spawn and terminate others, but must not move other workers of the states being iterated
+    template <class F>
+    void for_each_worker (int states, F&& fn) {
+        Worker* last[5];
+        for (size_t i = 0; i < 5; ++i) last[i] = lists[i].tail; // workers moved to another iterated state are not visited again
+        for (size_t i = 0; i < 5; ++i) {
+            if (!(states & (1 << i)) || !last[i]) continue;
+            for (auto w = lists[i].head; w;) {
+                auto next = w->list_next;
+                auto end  = w == last[i];
+                fn(w);
+                if (end) break;
+                w = next;
+            }
+        }
+    }
+
+    template <class F>
+    void for_each_worker (Worker::State state, F&& fn) { for_each_worker((int)state, std::forward<F>(fn)); }
 
 private:
-    std::vector<Worker*> get_workers (int states = 0);
-    std::vector<Worker*> get_workers (Worker::State state) { return get_workers((int)state); }
+    static size_t list_index (Worker::State state) {
+        switch (state) {
+            case Worker::State::starting    : return 0;
+            case Worker::State::running     : return 1;
+            case Worker::State::restarting  : return 2;
+            case Worker::State::terminating : return 3;
+            case Worker::State::standby     : return 4;
+        }
+        return 0;
+    }
 
     void check_workers              ();
+    void scale                      (const ScalingPolicy::Stats&, uint32_t lagging); // spawn/terminate workers by the check
+    void set_running                (Worker*);
     void fetch_state                ();
     void terminate_restared_workers ();
     void autorestart_workers        ();
     void kill_not_responding        ();
     void kill_not_terminated        ();
 
-    Worker* spawn               ();
+    Worker* spawn               (const Worker* replaced = nullptr);
+    Worker* spawn_worker        (bool standby, const Worker* replaced = nullptr);
+    Worker* activate_standby    ();
+    void    replenish_standby   ();
+    int32_t acquire_placement_slot (int32_t shared);
+    void    release_placement_slot (int32_t);
+    int32_t acquire_listen_slot    (int32_t shared);
+    void    release_listen_slot    (int32_t& slot, bool keep);
+    void    close_listen_slot      (ListenSlot&);
+    void    close_orphaned_listen_slots ();
+    void    close_listen_slots     ();
     void    terminate_workers   (uint32_t cnt);
     void    terminate_worker    (Worker*);
     void    kill_worker         (Worker*);
     Worker* restart_worker      (Worker*);
     void    restart_all_workers ();
+    void    continue_restart    ();
+
+    void start_metrics ();
 
-    excepted<void, string> create_and_bind_sockets (Config&);
     void close_socket (sock_t);
 };
 
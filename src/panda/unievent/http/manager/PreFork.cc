@@ -1,58 +1,265 @@
 #include "PreFork.h"
+#include "StlThread.h"
+#include "Affinity.h"
+#include "Memory.h"
 #include <unistd.h>
+#include <fcntl.h>
 #include <cstdlib>
 #include <signal.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef __linux__
+    #include <sys/prctl.h>
+#endif
+#include <cerrno>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <algorithm>
 
 namespace panda { namespace unievent { namespace http { namespace manager {
 
-struct Shmem {
-    struct Shdata {
+static const size_t cache_line_size = 64;
+
+// Flat shared-memory area with one cache-line-aligned slot per worker. It is mapped once in master before the first fork,
+// so every child inherits it and no per-worker mmap/munmap is needed. Slots are handed out lowest-first to keep live workers
+// packed at the beginning of the region, after the data common for all workers.
+struct Scoreboard {
+    struct alignas(cache_line_size) Common {
+        AcceptMutex accept_mutex;
+    };
+
+    struct alignas(cache_line_size) Slot {
         std::atomic<uint32_t> active_requests;
-        std::atomic<uint32_t> activity_time;
+        std::atomic<uint64_t> activity_time;   // last heartbeat, monotonic_ms()
         std::atomic<uint8_t>  load_average;
         std::atomic<uint32_t> total_requests;
-        std::atomic<uint32_t> recent_requests;
+        std::atomic<uint32_t> recent_requests; // monotonic, written only by child; master tracks the delta
+        std::atomic<uint32_t> connections;     // open connections
+        std::atomic<uint32_t> loop_lag_max;    // us, since previous heartbeat
+        std::atomic<uint32_t> loop_lag_p99;
+        std::atomic<uint64_t> probe_time;      // last tick of lag probe, monotonic_ms(), 0 if not probing
+        std::atomic<uint64_t> memory;          // resident memory, bytes
+        std::atomic<uint64_t> memory_pss;      // from smaps_rollup, bytes
+        std::atomic<uint64_t> memory_shared;
+        std::atomic<uint64_t> memory_private;
+        Histogram::Shared     latency;
     };
+    static_assert(sizeof(Slot) % cache_line_size == 0, "scoreboard slot must occupy whole cache lines");
+    static_assert(sizeof(Common) % cache_line_size == 0, "scoreboard common data must occupy whole cache lines");
+
+    Scoreboard (uint32_t capacity) : capacity(capacity), used(capacity, false) {
+        mapped_mem = mmap(nullptr, mapped_size(), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mapped_mem == MAP_FAILED) throw exception("could not map shared memory for scoreboard");
+    }
+
+    Slot* acquire () {
+        for (size_t i = 0; i < capacity; ++i) {
+            if (used[i]) continue;
+            used[i] = true;
+            auto slot = slots() + i;
+            reset(*slot);
+            return slot;
+        }
+        return nullptr;
+    }
+
+    void release (Slot* slot) {
+        used[index_of(slot)] = false;
+    }
+
+    size_t index_of (const Slot* slot) const {
+        auto idx = slot - slots();
+        assert(idx >= 0 && (size_t)idx < capacity);
+        return idx;
+    }
+
+    Slot* at (size_t idx) const {
+        assert(idx < capacity);
+        return slots() + idx;
+    }
+
+    Common& common () const { return *reinterpret_cast<Common*>(mapped_mem); }
+
+    static void reset (Slot& slot) {
+        slot.active_requests = 0;
+        slot.activity_time   = 0;
+        slot.load_average    = 0;
+        slot.total_requests  = 0;
+        slot.recent_requests = 0;
+        slot.connections     = 0;
+        slot.loop_lag_max    = 0;
+        slot.loop_lag_p99    = 0;
+        slot.probe_time      = 0;
+        slot.memory          = 0;
+        slot.memory_pss      = 0;
+        slot.memory_shared   = 0;
+        slot.memory_private  = 0;
+        slot.latency.reset();
+    }
+
+    ~Scoreboard () {
+        auto res = munmap(mapped_mem, mapped_size());
+        if (res) panda_log_critical("could not unmap scoreboard memory");
+    }
 
-    void* mapped_mem = nullptr;
+private:
+    void*             mapped_mem;
+    size_t            capacity;
+    std::vector<bool> used;
+
+    size_t mapped_size () const { return sizeof(Common) + capacity * sizeof(Slot); }
+
+    Slot* slots () const { return reinterpret_cast<Slot*>(static_cast<char*>(mapped_mem) + sizeof(Common)); }
+};
+
+static const size_t max_msg_fds    = 16;
+static const time_t zygote_timeout = 2; // seconds
+
+// sends data with file descriptors attached (SCM_RIGHTS), nfds = 0 to send data only
+static bool send_msg (int sock, const void* data, size_t len, const int* fds, size_t nfds, int flags) {
+    assert(nfds <= max_msg_fds);
+    iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len  = len;
+
+    union {
+        char    buf[CMSG_SPACE(sizeof(int) * max_msg_fds)];
+        cmsghdr align;
+    } ctl;
+    msghdr msg = {};
+    msg.msg_iov    = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds) {
+        msg.msg_control    = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+
+    ssize_t n;
+    do n = sendmsg(sock, &msg, flags | MSG_NOSIGNAL);
+    while (n == -1 && errno == EINTR);
+    return n == (ssize_t)len;
+}
+
+// receives data and up to nfds attached file descriptors (the rest of fds is set to -1), returns recvmsg() result
+static ssize_t recv_msg (int sock, void* data, size_t len, int* fds, size_t nfds, int flags) {
+    assert(nfds <= max_msg_fds);
+    iovec iov;
+    iov.iov_base = data;
+    iov.iov_len  = len;
+
+    union {
+        char    buf[CMSG_SPACE(sizeof(int) * max_msg_fds)];
+        cmsghdr align;
+    } ctl;
+    msghdr msg = {};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    ssize_t n;
+    do n = recvmsg(sock, &msg, flags);
+    while (n == -1 && errno == EINTR);
+
+    std::fill(fds, fds + nfds, -1);
+    if (n <= 0) return n;
+    size_t cnt = 0;
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        auto data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        for (size_t i = 0; i < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); ++i) {
+            int fd;
+            memcpy(&fd, data + i, sizeof(int));
+            if (cnt < nfds) fds[cnt++] = fd;
+            else close(fd); // unexpected
+        }
+    }
+    return n;
+}
+
+static void notify_master (int fd) {
+    char c = 0;
+    // EAGAIN means the pipe is full of unread notifications, master will check anyway
+    while (write(fd, &c, 1) == -1 && errno == EINTR) {}
+}
+
+struct Shmem {
+    using Shdata = Scoreboard::Slot;
+
+    ScoreboardSP scoreboard; // empty if slot is a standalone mapping (scoreboard overflow)
+    Shdata*      slot = nullptr;
 
     Shdata& shmem () {
-        return *(reinterpret_cast<Shdata*>(mapped_mem));
+        return *slot;
     }
 
-    void unmap_mem () {
-        if (!mapped_mem) return;
-        auto res = munmap(mapped_mem, sizeof(Shdata));
-        if (res) panda_log_critical("could not unmap memory");
-        mapped_mem = nullptr;
+    void attach_mem (const ScoreboardSP& sb) {
+        slot = sb->acquire();
+        if (slot) {
+            scoreboard = sb;
+            return;
+        }
+        // scoreboard is full (max_servers raised by reconfigure or long restart chains), fallback to a private mapping
+        auto mem = mmap(nullptr, sizeof(Shdata), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) throw exception("could not map shared memory");
+        slot = reinterpret_cast<Shdata*>(mem);
+        Scoreboard::reset(*slot);
     }
 
-    ~Shmem () { unmap_mem(); }
+    void release_mem () {
+        if (!slot) return;
+        if (scoreboard) {
+            scoreboard->release(slot);
+            scoreboard.reset();
+        } else {
+            auto res = munmap(slot, sizeof(Shdata));
+            if (res) panda_log_critical("could not unmap memory");
+        }
+        slot = nullptr;
+    }
+
+    ~Shmem () { release_mem(); }
 };
 
 struct PreForkWorker : Worker, Shmem {
     using Worker::Worker;
-    pid_t pid;
+    pid_t    pid;
+    uint32_t recent_seen = 0;
+    uint32_t latency_seen[Histogram::buckets_count] = {};
 
-    PreForkWorker () {
-        mapped_mem = mmap(nullptr, sizeof(Shmem::Shdata), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-        if (mapped_mem == MAP_FAILED) throw exception("could not map shared memory");
-        shmem().active_requests = 0;
-        shmem().activity_time   = 0;
-        shmem().load_average    = 0;
-        shmem().total_requests  = 0;
+    PreForkWorker (const ScoreboardSP& sb) {
+        attach_mem(sb);
     }
 
+    string system_id () const override { return to_string(pid); }
+
     void fetch_state () override {
         active_requests = shmem().active_requests;
         load_average    = (float)shmem().load_average / 100;
-        activity_time   = (time_t)shmem().activity_time;
+        activity_time   = shmem().activity_time;
         total_requests  = shmem().total_requests;
-        recent_requests = shmem().recent_requests;
-        shmem().recent_requests -= recent_requests;
+        connections     = shmem().connections;
+        loop_lag_max    = shmem().loop_lag_max;
+        loop_lag_p99    = shmem().loop_lag_p99;
+        probe_time      = shmem().probe_time;
+        memory          = shmem().memory;
+        memory_pss      = shmem().memory_pss;
+        memory_shared   = shmem().memory_shared;
+        memory_private  = shmem().memory_private;
+        uint32_t recent = shmem().recent_requests;
+        recent_requests = recent - recent_seen;
+        recent_seen     = recent;
+        latency.fetch(shmem().latency, latency_seen);
     }
 
     void terminate () override {
@@ -65,23 +272,69 @@ struct PreForkWorker : Worker, Shmem {
         send_signal(SIGKILL);
     }
 
+    void activate () override {
+        panda_log_info("activating standby worker pid=" << pid);
+        send_signal(SIGUSR1);
+    }
+
     void send_signal (int signum) {
         auto res = ::kill(pid, signum);
         if (res == -1) panda_log_critical("could not send signal " << signum << " to worker pid=" << pid);
     }
 };
 
+// The holder keeps its turn for at most max_hold ticks and leaves it earlier when its load crosses max_load.
+// After leaving, it sits out one tick so that others can take the turn. Loaded workers still compete, less often,
+// so that connections are accepted even when all workers are loaded
+AcceptTurn::Action AcceptTurn::tick (float load_average) {
+    bool loaded = load_average >= max_load;
+    if (held) {
+        ++ticks;
+        return (loaded || ticks >= max_hold) ? Action::Release : Action::None;
+    }
+    if (ticks) {
+        ticks = 0;
+        return Action::None;
+    }
+    if (loaded && ++skipped % 8) return Action::None;
+    return Action::Take;
+}
+
 struct PreForkChild : Child, Shmem {
     pid_t    master_pid;
     SignalSP term_signal;
+    SignalSP activate_signal;
+    int      notify_fd   = -1;
+    bool     ready_sent  = false;
+    uint64_t details_interval  = 0;
+    uint64_t details_last_time = 0;
 
-    void init (ServerParams p) override {
-        master_pid = getppid();
+    Scoreboard::Common* common = nullptr;
+    TimerSP             accept_timer;
+    AcceptTurn          accept_turn;
 
+    void init (ServerParams p) override {
         Child::init(p);
+        details_interval = p.config.memory_details_interval * 1000;
+
+        if (std::find(accept_cfg.serialized.begin(), accept_cfg.serialized.end(), true) != accept_cfg.serialized.end()) {
+            accept_turn.max_load = p.config.accept_max_load;
+            // strong: the worker has no other listeners to keep loop alive if all locations are shared
+            accept_timer = new Timer(loop);
+            accept_timer->event.add([this](auto&) { take_accept_turn(); });
+            accept_timer->start(p.config.accept_mutex_delay);
+        }
 
         term_signal = Signal::create(SIGINT, [this](auto...) { terminate(); }, loop);
         term_signal->weak(true);
+
+        if (standby) {
+            // strong handle keeps loop alive until activation as server is not running yet
+            activate_signal = Signal::create(SIGUSR1, [this](auto...) {
+                activate_signal->weak(true);
+                activate();
+            }, loop);
+        }
     }
 
     void run () override {
@@ -91,32 +344,216 @@ struct PreForkChild : Child, Shmem {
         std::exit(0);
     }
 
+    void terminate () override {
+        accept_timer.reset();
+        if (accept_turn.held) { // server stops listening anyway
+            accept_turn.held = false;
+            common->accept_mutex.release(getpid());
+        }
+        Child::terminate();
+    }
+
+    // accept_mutex: one worker at a time listens on shared sockets, so a new connection doesn't wake up the others
+    void take_accept_turn () {
+        if (standby || terminating) return;
+        switch (accept_turn.tick(loop->get_load_average())) {
+            case AcceptTurn::Action::Release:
+                release_accept_turn();
+                break;
+            case AcceptTurn::Action::Take:
+                if (!common->accept_mutex.take(getpid())) break;
+                accept_turn.held = true;
+                listen_serialized(true);
+                break;
+            case AcceptTurn::Action::None:
+                break;
+        }
+    }
+
+    void release_accept_turn () {
+        if (!accept_turn.held) return;
+        accept_turn.held = false;
+        listen_serialized(false); // before others can take the turn
+        common->accept_mutex.release(getpid());
+    }
+
     void send_active_requests (uint32_t areqs) override {
         shmem().active_requests = areqs;
     }
 
-    void send_activity (time_t now, float la, uint32_t total_requests, uint32_t recent_requests) override {
+    void send_request_time (uint64_t us) override {
+        shmem().latency.record(us);
+    }
+
+    void send_activity (uint64_t now, float la, uint32_t total_requests, uint32_t recent_requests, uint32_t connections, uint32_t lag_max, uint32_t lag_p99) override {
         if (kill(master_pid, 0) != 0) {
             panda_log_info("master process died, terminating...");
             server->stop();
             std::exit(0);
         }
         shmem().load_average     = la * 100;
-        shmem().activity_time    = (uint32_t)now;
+        shmem().activity_time    = now;
         shmem().total_requests   = total_requests;
-        shmem().recent_requests += recent_requests;
+        shmem().connections      = connections;
+        shmem().loop_lag_max     = lag_max;
+        shmem().loop_lag_p99     = lag_p99;
+        shmem().recent_requests.store(shmem().recent_requests.load(std::memory_order_relaxed) + recent_requests); // the only writer
+        if (!ready_sent) {
+            ready_sent = true;
+            notify(); // don't wait for master's next check to be counted as running
+        }
+    }
+
+    void send_notification () override {
+        notify_master(notify_fd);
+    }
+
+    void send_memory_usage () override {
+        shmem().memory = process_rss();
+        if (!details_interval) return;
+        auto now = monotonic_ms();
+        if (details_last_time && now - details_last_time < details_interval) return;
+        details_last_time = now;
+        MemoryDetails md;
+        if (!process_memory_details(md)) {
+            details_interval = 0; // not supported by kernel, don't try again
+            return;
+        }
+        shmem().memory_pss     = md.pss;
+        shmem().memory_shared  = md.shared;
+        shmem().memory_private = md.priv;
+    }
+
+    void send_probe_time (uint64_t now) override {
+        shmem().probe_time = now;
+    }
+};
+
+ThreadTotals ThreadTotals::sum (const Workers& workers) {
+    ThreadTotals ret;
+    for (auto& row : workers) {
+        auto w = row.second.get();
+        ret.active_requests += w->active_requests;
+        ret.recent_requests += w->recent_requests;
+        ret.connections     += w->connections;
+        ret.loop_lag_max     = std::max(ret.loop_lag_max, w->loop_lag_max);
+        ret.loop_lag_p99     = std::max(ret.loop_lag_p99, w->loop_lag_p99);
+    }
+    return ret;
+}
+
+// hybrid worker model: worker process runs thread worker model inside and reports aggregated stats of its threads
+struct HybridThreads : StlThread {
+    Shmem::Shdata& shdata;
+    pid_t          master_pid;
+    int            notify_fd;
+    uint32_t       served     = 0;
+    bool           ready_sent = false;
+
+    HybridThreads (const Config& config, Shmem::Shdata& shdata, pid_t master_pid, int notify_fd)
+        : StlThread(config, new Loop(), Loop::default_loop()), shdata(shdata), master_pid(master_pid), notify_fd(notify_fd) {}
+
+    void checked (const ScalingPolicy::Stats& st) override {
+        if (kill(master_pid, 0) != 0) {
+            panda_log_info("master process died, terminating...");
+            loop->delay([this]{ stop(); }); // not from the middle of check
+            return;
+        }
+
+        auto totals = ThreadTotals::sum(workers);
+        served += totals.recent_requests; // per-thread totals are lost when threads are restarted
+
+        shdata.active_requests = totals.active_requests;
+        shdata.load_average    = st.avgload * 100;
+        shdata.total_requests  = served;
+        shdata.connections     = totals.connections;
+        shdata.loop_lag_max    = totals.loop_lag_max; // stalled threads are killed by this process, probe_time is left 0
+        shdata.loop_lag_p99    = totals.loop_lag_p99;
+        shdata.recent_requests.store(shdata.recent_requests.load(std::memory_order_relaxed) + totals.recent_requests); // the only writer
+        shdata.latency.add(latency);
+        shdata.activity_time   = monotonic_ms();
+        shdata.memory          = process_rss();
+
+        if (!ready_sent && config.notify_interval) {
+            ready_sent = true;
+            notify_master(notify_fd);
+        }
+    }
+};
+
+struct HybridChild : PreForkChild {
+    std::unique_ptr<HybridThreads> threads;
+
+    void init (ServerParams p) override {
+        if (p.placement_slot >= 0) { // threads inherit process placement
+            auto placement = Placement::for_slot(p.config, p.placement_slot);
+            if (placement.apply()) panda_log_info("worker: bound to " << placement);
+        }
+
+        // threads are scaled inside the process within [1, threads_per_worker], processes are scaled by master
+        auto config = p.config;
+        config.worker_model       = Manager::WorkerModel::Thread;
+        config.min_servers        = 1;
+        config.max_servers        = config.threads_per_worker;
+        config.min_spare_servers  = 0;
+        config.max_spare_servers  = 0;
+        config.zygote             = false;
+        config.affinity           = Manager::Affinity::None;
+        config.metrics_location   = {};
+        config.max_worker_rss     = 0; // whole process is restarted by master
+        config.per_worker_sockets = false;
+        if (p.listen_socks.size()) Child::use_listen_socks(config.server, p.listen_socks); // threads listen on duplicates
+
+        threads = std::make_unique<HybridThreads>(config, shmem(), master_pid, notify_fd);
+        threads->server_factory = p.server_factory;
+        threads->spawn_event    = p.spawn_event;
+        threads->request_event  = p.request_event;
+
+        term_signal = Signal::create(SIGINT, [this](auto...) { threads->stop(); }, threads->get_loop());
+        term_signal->weak(true);
+    }
+
+    void run () override {
+        threads->run();
+        panda_log_info("worker terminated");
+        std::exit(0);
     }
 };
 
+static std::unique_ptr<PreForkChild> make_child (const Mpm::Config& config) {
+    if (config.worker_model == Manager::WorkerModel::Hybrid) return std::make_unique<HybridChild>();
+    return std::make_unique<PreForkChild>();
+}
+
 using ChildPtr = std::unique_ptr<Child>;
 
-struct RunChildInOuterScope {
-    ChildPtr child;
+// request from master to zygote, zygote replies with pid_t of the new worker or -1.
+// attached descriptors: per-worker listen sockets
+struct ZygoteRequest {
+    uint32_t slot;
+    int32_t  placement_slot;
+    uint8_t  standby;
 };
 
 void PreFork::run () {
+    master_pid = getpid();
+    // twice max_servers to cover restart handover when old and new workers coexist
+    scoreboard = std::make_shared<Scoreboard>(config.max_servers * 2);
     sigchld = Signal::create(SIGCHLD, [this](auto...){ handle_sigchld(); }, loop);
 
+    // single pipe for all workers: notification carries no data, master just checks scoreboard earlier than by timer
+    int fds[2];
+    if (pipe(fds) != 0) throw exception("could not create notification pipe");
+    for (auto fd : fds) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    notify_fd   = fds[1];
+    notify_poll = new Poll(Poll::Fd{fds[0]}, loop);
+    notify_poll->weak(true);
+    notify_poll->start(Poll::READABLE, [this, fd = fds[0]](auto...) {
+        char buf[256];
+        while (read(fd, buf, sizeof(buf)) > 0) {}
+        notified();
+    });
+
     ChildPtr child;
     try {
         Mpm::run();
@@ -135,56 +572,229 @@ void PreFork::handle_sigchld () {
     pid_t pid;
     int wstatus;
     while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
-        panda_log_info("worker pid=" << pid << " terminated");
-        for (auto& row : workers) {
-            auto worker = static_cast<PreForkWorker*>(row.second.get());
-            if (worker->pid == pid) {
-                worker_terminated(worker);
-                break;
+        if (pid == zygote_pid) {
+            stop_zygote();
+            if (state != State::running || !config.zygote) continue;
+            if (monotonic_ms() - zygote_start_time < 1000) {
+                panda_log_critical("zygote pid=" << pid << " died right after start, forking workers from master");
+                continue;
             }
+            panda_log_critical("zygote pid=" << pid << " died, restarting it");
+            loop->delay([this]{ start_zygote(); }); // pure loop code flow, see create_worker()
+            continue;
         }
+        panda_log_info("worker pid=" << pid << " terminated");
+        scoreboard->common().accept_mutex.release(pid); // died or killed while accepting
+        auto it = pids.find(pid);
+        if (it == pids.end()) continue;
+        auto worker = it->second;
+        pids.erase(it);
+        worker_terminated(worker);
     }
 }
 
-WorkerPtr PreFork::create_worker () {
-    auto worker = std::make_unique<PreForkWorker>();
+WorkerPtr PreFork::create_worker (const WorkerParams& params) {
+    auto worker = std::make_unique<PreForkWorker>(scoreboard);
+
+    // standalone (overflow) shared memory can't be passed to zygote as it is mapped after zygote was forked
+    if (zygote_fd != -1 && worker->scoreboard && params.listen_socks.size() <= max_msg_fds) {
+        auto pid = zygote_spawn(scoreboard->index_of(worker->slot), params);
+        if (pid > 0) {
+            worker->pid = pid;
+            pids[pid] = worker.get();
+            return WorkerPtr(worker.release());
+        }
+        panda_log_critical("zygote failed to spawn worker or did not reply in time, forking from master");
+        stop_zygote();
+    }
 
     auto pid = fork();
     if (pid == -1) throw exception("could not fork worker");
 
     if (pid) {
         worker->pid = pid;
+        pids[pid] = worker.get();
         return WorkerPtr(worker.release());
     }
 
-    // release shared memory for other workers as we forked and cloned all of them
+    release_master_resources(params.listen_socks);
+
+    auto child = make_child(config);
+    child->slot        = worker->slot;
+    child->scoreboard  = std::move(worker->scoreboard);
+    worker->slot       = nullptr;
+    run_child(std::move(child), params);
+}
+
+void PreFork::release_master_resources (const std::vector<sock_t>& keep_socks) {
+    // forget other workers' slots; only standalone (overflow) mappings are actually unmapped, scoreboard stays mapped
     for (auto& row : workers) {
         auto worker = static_cast<PreForkWorker*>(row.second.get());
-        worker->unmap_mem();
+        worker->release_mem();
     }
 
+    // a socket left open in a process which doesn't accept on it would get its share of connections forever
+    for (auto& slot : listen_slots) {
+        for (auto sock : slot.socks) {
+            if (std::find(keep_socks.begin(), keep_socks.end(), sock) == keep_socks.end()) close(sock);
+        }
+    }
+    listen_slots.clear();
+
     // release manager's resources
     check_timer.reset();
     check_termination_timer.reset();
+    notify_timer.reset();
+    metrics.reset();
     sigchld.reset();
+    notify_poll.reset(); // closes read end, worker keeps notify_fd for writing
+    pids.clear();
+    if (zygote_fd != -1) {
+        close(zygote_fd);
+        zygote_fd = -1;
+    }
+}
 
-    auto child = std::make_unique<PreForkChild>();
-    child->mapped_mem = worker->mapped_mem;
-    worker->mapped_mem = nullptr;
-    child->init({worker_loop, config, server_factory, spawn_event, request_event});
+void PreFork::run_child (std::unique_ptr<PreForkChild> child, const WorkerParams& params) {
+    child->master_pid = master_pid; // not getppid() as worker forked by zygote is reparented to master
+    child->notify_fd  = notify_fd;
+    child->common     = &scoreboard->common();
+    child->init({worker_loop, config, server_factory, spawn_event, request_event, params.standby, params.placement_slot, params.listen_socks});
 
     // we can't run child here because it would be a recursive loop run call.
     // we need to bail out of loop execution and run child from there
     throw RunChildInOuterScope{std::move(child)};
 }
 
+void PreFork::started () {
+    if (config.zygote) start_zygote();
+}
+
+void PreFork::reconfigured () {
+    // zygote holds a copy of config and listening sockets, so replace it with a fresh one
+    stop_zygote();
+    if (config.zygote) start_zygote();
+}
+
+void PreFork::start_zygote () {
+    #ifdef __linux__
+    // zygote double-forks workers; we become their parent so that SIGCHLD and waitpid() keep working as usual
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) != 0) {
+        panda_log_critical("could not become child subreaper, forking workers from master");
+        return;
+    }
+    #else
+    panda_log_warning("zygote is only supported on linux, forking workers from master");
+    return;
+    #endif
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        panda_log_critical("could not create socketpair for zygote, forking workers from master");
+        return;
+    }
+
+    auto pid = fork();
+    if (pid == -1) {
+        panda_log_critical("could not fork zygote, forking workers from master");
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+
+    if (pid) {
+        close(fds[1]);
+        // master's loop is blocked while it waits for zygote, a stuck zygote is treated as failed
+        timeval tv {zygote_timeout, 0};
+        setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fds[0], SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        zygote_fd         = fds[0];
+        zygote_pid        = pid;
+        zygote_start_time = monotonic_ms();
+        panda_log_info("zygote pid=" << pid << " started");
+        return;
+    }
+
+    close(fds[0]);
+    release_master_resources();
+    run_zygote(fds[1]);
+}
+
+void PreFork::stop_zygote () {
+    if (zygote_fd == -1) return;
+    close(zygote_fd); // zygote exits when it reads EOF
+    zygote_fd  = -1;
+    zygote_pid = 0;
+}
+
+pid_t PreFork::zygote_spawn (uint32_t slot, const WorkerParams& params) {
+    ZygoteRequest req{slot, params.placement_slot, params.standby};
+    auto& fds = params.listen_socks;
+    if (!send_msg(zygote_fd, &req, sizeof(req), fds.data(), fds.size(), 0)) return -1;
+
+    pid_t pid;
+    ssize_t n;
+    do n = recv(zygote_fd, &pid, sizeof(pid), MSG_WAITALL);
+    while (n == -1 && errno == EINTR);
+
+    return n == sizeof(pid) ? pid : -1;
+}
+
+void PreFork::run_zygote (int fd) {
+    panda_log_info("zygote: waiting for spawn requests");
+    while (true) {
+        ZygoteRequest req;
+        int fds[max_msg_fds];
+        auto n = recv_msg(fd, &req, sizeof(req), fds, max_msg_fds, MSG_WAITALL);
+        if (n != sizeof(req)) _exit(0); // master closed connection or died
+
+        auto nfds      = std::find(fds, fds + max_msg_fds, -1) - fds;
+        auto close_fds = [&] { for (decltype(nfds) i = 0; i < nfds; ++i) close(fds[i]); };
+
+        auto pid = fork();
+        if (pid == -1) {
+            pid_t err = -1;
+            send(fd, &err, sizeof(err), MSG_NOSIGNAL);
+            close_fds();
+            continue;
+        }
+        if (pid) { // reap intermediate process, the worker is reparented to master
+            close_fds();
+            while (waitpid(pid, nullptr, 0) == -1 && errno == EINTR) {}
+            continue;
+        }
+
+        auto wpid = fork();
+        if (wpid) { // intermediate process: report worker pid (or -1) and exit
+            send(fd, &wpid, sizeof(wpid), MSG_NOSIGNAL);
+            _exit(0);
+        }
+
+        close(fd);
+        auto child = make_child(config);
+        child->slot        = scoreboard->at(req.slot);
+        child->scoreboard  = scoreboard;
+        WorkerParams params;
+        params.standby        = req.standby;
+        params.placement_slot = req.placement_slot;
+        params.listen_socks.assign(fds, fds + nfds);
+        run_child(std::move(child), params);
+    }
+}
+
 void PreFork::stop () {
     Mpm::stop();
 }
 
 void PreFork::stopped () {
     Mpm::stopped();
+    stop_zygote();
     sigchld.reset();
+    notify_poll.reset();
+    if (notify_fd != -1) {
+        close(notify_fd);
+        notify_fd = -1;
+    }
 }
 
 }}}}
@@ -1,21 +1,84 @@
 #pragma once
 #include "Mpm.h"
+#include <panda/unievent/Poll.h>
 #include <panda/unievent/Signal.h>
+#include <sys/types.h>
+#include <unordered_map>
+#include <atomic>
 
 namespace panda { namespace unievent { namespace http { namespace manager {
 
+struct Scoreboard;
+struct PreForkChild;
+using ScoreboardSP = std::shared_ptr<Scoreboard>;
+
+// hybrid: what worker process reports to master on behalf of its threads
+struct ThreadTotals {
+    uint32_t active_requests = 0;
+    uint32_t recent_requests = 0;
+    uint32_t connections     = 0;
+    uint32_t loop_lag_max    = 0; // the highest of threads
+    uint32_t loop_lag_p99    = 0;
+
+    static ThreadTotals sum (const Workers&);
+};
+
+// accept_mutex: lives in shared memory, at most one worker process holds it at a time
+struct AcceptMutex {
+    std::atomic<pid_t> holder {0}; // worker which accepts on shared locations, 0 if none
+
+    bool take    (pid_t pid) { pid_t none = 0; return holder.compare_exchange_strong(none, pid); }
+    bool release (pid_t pid) { return holder.compare_exchange_strong(pid, 0); } // no-op if pid is not the holder
+};
+
+// accept_mutex: when a worker tries to take its turn or leaves it, ticked every accept_mutex_delay
+struct AcceptTurn {
+    enum class Action { None, Take, Release };
+
+    static const uint32_t max_hold = 8; // ticks, then the turn is left to others
+
+    float    max_load = 0;
+    bool     held     = false; // set by caller once the mutex is taken
+    uint32_t skipped  = 0;
+    uint32_t ticks    = 0;     // since the turn was taken, kept for one tick after it is left
+
+    Action tick (float load_average);
+};
+
 struct PreFork : Mpm {
     using Mpm::Mpm;
 
     void      run           () override;
-    WorkerPtr create_worker () override;
+    WorkerPtr create_worker (const WorkerParams&) override;
     void      stop          () override;
     void      stopped       () override;
 
+protected:
+    void started      () override;
+    void reconfigured () override;
+
 private:
-    SignalSP sigchld;
+    SignalSP     sigchld;
+    PollSP       notify_poll;            // read end of notification pipe, workers write to notify_fd
+    int          notify_fd         = -1;
+    ScoreboardSP scoreboard;
+    pid_t        master_pid        = 0;
+    pid_t        zygote_pid        = 0;
+    int          zygote_fd         = -1;
+    uint64_t     zygote_start_time = 0; // monotonic_ms()
+
+    std::unordered_map<pid_t, Worker*> pids; // for reaping without scanning all workers
+
+    void handle_sigchld           ();
+    void release_master_resources (const std::vector<sock_t>& keep_socks = {}); // in worker or zygote after fork
+
+    [[noreturn]] void run_child (std::unique_ptr<PreForkChild>, const WorkerParams&);
+
+    void  start_zygote ();
+    void  stop_zygote  ();
+    pid_t zygote_spawn (uint32_t slot, const WorkerParams&);
 
-    void handle_sigchld ();
+    [[noreturn]] void run_zygote (int fd);
 };
 
 }}}}
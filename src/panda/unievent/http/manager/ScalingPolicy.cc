@@ -0,0 +1,83 @@
+#include "ScalingPolicy.h"
+#include <cmath>
+#include <algorithm>
+#include <iomanip>
+
+namespace panda { namespace unievent { namespace http { namespace manager {
+
+std::unique_ptr<ScalingPolicy> ScalingPolicy::create (Manager::ScalingModel model) {
+    switch (model) {
+        case Manager::ScalingModel::Threshold : return std::make_unique<ThresholdScalingPolicy>();
+        case Manager::ScalingModel::Pid       : return std::make_unique<PidScalingPolicy>();
+    }
+    throw exception("unknown scaling model");
+}
+
+int32_t ThresholdScalingPolicy::decide (const Config& config, const Stats& st) {
+    // first check if we have too few workers
+    uint32_t needed[] = {0,0,0};
+    if (st.total < config.min_servers)          needed[0] = config.min_servers - st.total;
+    if (st.inactive < config.min_spare_servers) needed[1] = config.min_spare_servers - st.inactive;
+    if (st.avgload > config.max_load)           needed[2] = ceil(st.sumload / config.max_load) - st.total;
+
+    auto cnt_to_spawn = std::max({needed[0], needed[1], needed[2]});
+    if (cnt_to_spawn && st.total < config.max_servers) {
+        panda_log_debug("needed by: min_servers=" << needed[0] << " min_spare_servers=" << needed[1] << " max_load=" << needed[2]);
+        return cnt_to_spawn;
+    }
+
+    // now check if we have too many workers
+    uint32_t wanted[3] = {0,0,0};
+    if (st.total > config.max_servers)                                      wanted[0] = st.total - config.max_servers;
+    if (config.max_spare_servers && st.inactive > config.max_spare_servers) wanted[1] = st.inactive - config.max_spare_servers;
+    if (config.min_load && st.avgload < config.min_load)                    wanted[2] = st.total - uint32_t(st.sumload / config.min_load);
+
+    auto cnt_to_term = std::max({wanted[0], wanted[1], wanted[2]});
+    if (cnt_to_term) {
+        panda_log_debug("wanted to terminate by: max_servers=" << wanted[0] << " max_spare_servers=" << wanted[1] << " min_load=" << wanted[2]);
+    }
+    return -(int32_t)cnt_to_term;
+}
+
+int32_t PidScalingPolicy::decide (const Config& config, const Stats& st) {
+    if (!st.total) return 0; // nothing to measure, min_servers takes care
+
+    auto alpha     = config.ewma_alpha;
+    auto prev_reqs = req_ewma;
+    if (!initialized) {
+        load_ewma   = st.avgload;
+        req_ewma    = prev_reqs = st.req_speed;
+        initialized = true;
+    } else {
+        load_ewma = alpha * st.avgload   + (1 - alpha) * load_ewma;
+        req_ewma  = alpha * st.req_speed + (1 - alpha) * req_ewma;
+    }
+
+    float error = (load_ewma - config.target_load) / config.target_load;
+    float trend = 0;
+
+    // no time passed since the previous check (the first one or several in one millisecond): proportional term only
+    if (st.interval > 0) {
+        trend = prev_reqs > 0 ? (req_ewma - prev_reqs) / prev_reqs / st.interval : 0;
+        integral += error * st.interval;
+        // anti-windup: integral term alone may never ask for more than doubling or for removing all workers
+        if (config.pid_ki) {
+            auto limit = 1 / config.pid_ki;
+            integral = std::max(-limit, std::min(limit, integral));
+        }
+    }
+
+    float u     = config.pid_kp * error + config.pid_ki * integral + config.pid_kd * trend;
+    float delta = st.total * u;
+
+    panda_log_debug(
+        "pid: load ewma=" << std::setprecision(3) << std::fixed << load_ewma << ", reqs ewma=" << req_ewma <<
+        ", error=" << error << ", integral=" << integral << ", trend=" << trend << ", output=" << u
+    );
+
+    // asymmetric rounding: scale up eagerly, scale down only by whole idle workers
+    if (delta > 0) return (int32_t)std::ceil(delta - 0.01f);
+    return (int32_t)delta;
+}
+
+}}}}
@@ -0,0 +1,41 @@
+#pragma once
+#include "Manager.h"
+#include <memory>
+
+namespace panda { namespace unievent { namespace http { namespace manager {
+
+// decides how many workers to add (positive) or remove (negative) on each check.
+// result is clamped by min_servers/max_servers afterwards, so policies don't have to care about it
+struct ScalingPolicy {
+    using Config = Manager::Config;
+
+    using Stats  = Manager::CheckStats;
+
+    static std::unique_ptr<ScalingPolicy> create (Manager::ScalingModel);
+
+    virtual int32_t decide (const Config&, const Stats&) = 0;
+
+    virtual ~ScalingPolicy () {}
+};
+
+using ScalingPolicyPtr = std::unique_ptr<ScalingPolicy>;
+
+// spawns by the highest of min_servers/min_spare_servers/max_load demands, terminates by max_servers/max_spare_servers/min_load
+struct ThresholdScalingPolicy : ScalingPolicy {
+    int32_t decide (const Config&, const Stats&) override;
+};
+
+// smooths load average and request rate with EWMA and drives worker count towards target_load with PID loop.
+// proportional and integral terms act on relative load error, derivative term acts on request rate trend so that ramps
+// are followed before they show up in load average
+struct PidScalingPolicy : ScalingPolicy {
+    int32_t decide (const Config&, const Stats&) override;
+
+private:
+    bool  initialized = false;
+    float load_ewma   = 0;
+    float req_ewma    = 0;
+    float integral    = 0;
+};
+
+}}}}
@@ -1,11 +1,12 @@
 #include "Thread.h"
+#include "Memory.h"
 #include <mutex>
-#include <future>
 #include <panda/unievent/util.h>
 
 namespace panda { namespace unievent { namespace http { namespace manager {
 
-static std::mutex mutex;
+static std::mutex mutex;        // worker initialization and teardown run thread-unsafe user code, one worker at a time
+static std::mutex thread_mutex; // master's config is shared with threads' copies: held while threads are created and destroy their copies
 
 struct ThreadChild : Child {
     ThreadWorker::SharedData& shared;
@@ -27,12 +28,38 @@ struct ThreadChild : Child {
         shared.active_requests = areqs;
     }
 
-    void send_activity (time_t now, float la, uint32_t total_requests, uint32_t recent_requests) override {
+    void send_request_time (uint64_t us) override {
+        shared.latency.record(us);
+    }
+
+    void send_notification () override {
+        shared.notify_handle->send();
+    }
+
+    void send_memory_usage () override {
+        shared.memory = thread_allocated();
+    }
+
+    void send_probe_time (uint64_t now) override {
+        shared.probe_time = now;
+    }
+
+    void send_activity (uint64_t now, float la, uint32_t total_requests, uint32_t recent_requests, uint32_t connections, uint32_t lag_max, uint32_t lag_p99) override {
         shared.load_average    = la;
         shared.activity_time   = now;
         shared.total_requests  = total_requests;
         shared.recent_requests = recent_requests;
+        shared.connections     = connections;
+        shared.loop_lag_max    = lag_max;
+        shared.loop_lag_p99    = lag_p99;
+        if (!ready_sent) {
+            ready_sent = true;
+            shared.ready_handle->send();
+        }
     }
+
+private:
+    bool ready_sent = false;
 };
 
 
@@ -41,7 +68,15 @@ ThreadWorker::ThreadWorker () {
     shared.activity_time   = 0;
     shared.load_average    = 0;
     shared.total_requests  = 0;
+    shared.recent_requests = 0;
+    shared.connections     = 0;
+    shared.loop_lag_max    = 0;
+    shared.loop_lag_p99    = 0;
+    shared.probe_time      = 0;
+    shared.memory          = 0;
+    shared.latency.reset();
     shared.terminate       = false;
+    shared.activate        = false;
     shared.die             = false;
 }
 
@@ -50,8 +85,14 @@ void ThreadWorker::fetch_state () {
     load_average    = shared.load_average;
     activity_time   = shared.activity_time;
     total_requests  = shared.total_requests;
+    connections     = shared.connections;
+    loop_lag_max    = shared.loop_lag_max;
+    loop_lag_p99    = shared.loop_lag_p99;
+    probe_time      = shared.probe_time;
+    memory          = shared.memory;
     recent_requests = shared.recent_requests;
     shared.recent_requests -= recent_requests;
+    latency.fetch(shared.latency, latency_seen);
 }
 
 void ThreadWorker::terminate () {
@@ -64,10 +105,24 @@ void ThreadWorker::terminate () {
     }
 }
 
+void ThreadWorker::activate () {
+    panda_log_info("master thread: activate standby worker thread=" << tid());
+    shared.activate = true;
+
+    std::lock_guard<std::mutex> lock(shared.control_mutex);
+    if (shared.control_handle) {
+        shared.control_handle->send();
+    }
+}
+
 void ThreadWorker::kill () {
     panda_log_info("master thread: killing worker thread=" << tid());
     shared.die = true;
-    shared.control_handle->send();
+
+    std::lock_guard<std::mutex> lock(shared.control_mutex);
+    if (shared.control_handle) {
+        shared.control_handle->send();
+    }
 }
 
 
@@ -76,14 +131,16 @@ Thread::Thread (const Config& _c, const LoopSP& _loop, const LoopSP& _worker_loo
 }
 
 void Thread::run () {
+    if (config.max_worker_rss && !thread_allocated_supported()) {
+        panda_log_warning("max_worker_rss is ignored: allocator doesn't provide per-thread statistics");
+    }
+    notify_handle = new Async(loop);
+    notify_handle->weak(true);
+    notify_handle->event.add([this](auto&) { notified(); });
     Mpm::run();
 }
 
-WorkerPtr Thread::create_worker () {
-    std::lock_guard<std::mutex> lock(mutex); // sync with thread dtors
-
-    std::promise<bool> init_promise;
-
+WorkerPtr Thread::create_worker (const WorkerParams& params) {
     auto worker = make_thread_worker();
     worker->shared.termination_handle = new Async(loop);
     worker->shared.termination_handle->event.add([this, worker = worker.get()](auto&) {
@@ -93,61 +150,102 @@ WorkerPtr Thread::create_worker () {
         worker_terminated(worker);
     });
 
-    std::function<void()> thr_fn = [this, &shared = worker->shared, &init_promise] {
-        ThreadChild child(shared);
+    worker->shared.notify_handle = notify_handle;
+
+    worker->shared.ready_handle = new Async(loop);
+    worker->shared.ready_handle->weak(true);
+    worker->shared.ready_handle->event.add([this, worker = worker.get()](auto&) {
+        worker_ready(worker);
+    });
+
+    // master may close its copies of per-worker sockets any time after this call
+    std::vector<sock_t> listen_socks;
+    for (auto sock : params.listen_socks) listen_socks.push_back(sock_dup(sock));
+
+    std::lock_guard<std::mutex> lock(thread_mutex); // released after master's references to the copy are gone
+
+    // worker gets its copy before it starts, so that reconfigure() doesn't have to wait for initializing workers
+    auto config = std::make_shared<Config>(this->config);
+    // duplicate non-reuse-port locations for worker (reuse-port locations don't have sockets in config)
+    for (auto& loc : config->server.locations) {
+        if (loc.sock) loc.sock = sock_dup(loc.sock.value());
+    }
+
+    std::function<void()> thr_fn = [this, &shared = worker->shared, params, listen_socks, config]() mutable {
+        auto child = std::make_unique<ThreadChild>(shared);
+        auto release = [&child, &config] { // server and config copies share refcounted data with master's config
+            std::lock_guard<std::mutex> lock(thread_mutex);
+            child.reset();
+            config.reset();
+        };
+
         auto loop = Loop::default_loop(); // this loop is thread-local, DO NOT use this->loop !
         AsyncSP control_handle = new Async(loop);
 
-        try {
-            shared.control_handle = control_handle;
-            shared.control_handle->weak(true);
-            shared.control_handle->event.add([&shared, &child, &loop](auto&) {
-                if (shared.die) {
-                    loop->stop();
-                }
-                else if (shared.terminate) {
-                    child.terminate();
-                }
-            });
-
-            auto config = this->config; // copy
-            // duplicate non-reuse-port locations for worker (reuse-port locations don't have sockets in config)
-            for (auto& loc : config.server.locations) {
-                if (loc.sock) loc.sock = sock_dup(loc.sock.value());
+        {
+            // initialization callbacks may run thread-unsafe code and copy non-atomic iptrs in functions,
+            // so workers initialize one at a time. master loop is not blocked meanwhile.
+            std::lock_guard<std::mutex> lock(mutex);
+            try {
+                control_handle->weak(!params.standby); // standby worker has no running server to keep loop alive
+                control_handle->event.add([&shared, &child, &loop](auto& handle) {
+                    if (shared.die) {
+                        loop->stop();
+                        return;
+                    }
+
+                    if (shared.activate) { // no-op if already active or terminating
+                        handle->weak(true);
+                        child->activate();
+                    }
+
+                    if (shared.terminate) {
+                        child->terminate();
+                    }
+                });
+
+                child->init({loop, *config, server_factory, spawn_event, request_event, params.standby, params.placement_slot, listen_socks});
+            }
+            catch (...) {
+                release();
+                shared.termination_handle->send();
+                throw;
             }
-
-            child.init({loop, config, server_factory, spawn_event, request_event});
-        }
-        catch (...) {
-            init_promise.set_value(true);
-            shared.termination_handle->send();
-            throw;
         }
 
-        init_promise.set_value(true);
+        {
+            std::lock_guard<std::mutex> lock(shared.control_mutex);
+            shared.control_handle = control_handle;
+        }
+        // master could have asked us to terminate/activate while we were initializing
+        if (shared.die || shared.terminate || shared.activate) control_handle->send();
 
-        child.run();
+        child->run();
 
         {
             std::lock_guard<std::mutex> lock(shared.control_mutex);
             shared.control_handle = nullptr;
         }
+        release();
         shared.termination_handle->send();
     };
 
     worker->create_thread(thr_fn);
 
-    // wait until thread initializes to allow running thread-unsafe code in worker initialization callbacks
-    init_promise.get_future().wait();
-
     return WorkerPtr(worker.release());
 }
 
+excepted<void, string> Thread::reconfigure (const Config& cfg) {
+    std::lock_guard<std::mutex> lock(thread_mutex); // threads may be destroying their copies of config
+    return Mpm::reconfigure(cfg);
+}
+
 void Thread::stop () {
     Mpm::stop();
 }
 
 void Thread::stopped () {
+    notify_handle.reset(); // all worker threads are joined
     Mpm::stopped();
 }
 
@@ -8,26 +8,40 @@ namespace panda { namespace unievent { namespace http { namespace manager {
 
 struct ThreadWorker : Worker {
     struct SharedData {
-        Async*                control_handle;
+        Async*                control_handle = nullptr;
         std::mutex            control_mutex;
         AsyncSP               termination_handle;
+        AsyncSP               ready_handle;       // worker has sent its first activity stats
+        Async*                notify_handle  = nullptr; // master's, shared by all workers
         std::atomic<uint32_t> active_requests;
-        std::atomic<time_t>   activity_time;
+        std::atomic<uint64_t> activity_time;
         std::atomic<float>    load_average;
         std::atomic<uint32_t> total_requests;
         std::atomic<uint32_t> recent_requests;
+        std::atomic<uint32_t> connections;
+        std::atomic<uint32_t> loop_lag_max;
+        std::atomic<uint32_t> loop_lag_p99;
+        std::atomic<uint64_t> probe_time;
+        std::atomic<uint64_t> memory;
+        Histogram::Shared     latency;
         std::atomic<bool>     terminate;
+        std::atomic<bool>     activate;
         std::atomic<bool>     die;
     } shared;
 
+    uint32_t latency_seen[Histogram::buckets_count] = {};
+
     ThreadWorker ();
 
     void fetch_state () override;
     void terminate   () override;
     void kill        () override;
+    void activate    () override;
 
     virtual std::string tid () const = 0;
 
+    string system_id () const override { return string(tid().c_str()); }
+
     virtual void create_thread (const std::function<void()>& fn) = 0;
     virtual void join          () = 0;
 };
@@ -36,11 +50,15 @@ struct Thread : Mpm {
     Thread (const Config&, const LoopSP&, const LoopSP&);
 
     void      run           () override;
-    WorkerPtr create_worker () override;
+    WorkerPtr create_worker (const WorkerParams&) override;
     void      stop          () override;
     void      stopped       () override;
 
+    excepted<void, string> reconfigure (const Config&) override;
+
 protected:
+    AsyncSP notify_handle;
+
     virtual std::unique_ptr<ThreadWorker> make_thread_worker () const = 0;
 };
 
@@ -1,5 +1,7 @@
 #include <catch2/catch_test_macros.hpp>
 #include <panda/unievent/http/manager/Mpm.h>
+#include <panda/unievent/http/manager/Metrics.h>
+#include <algorithm>
 
 using namespace panda;
 using namespace panda::unievent::http::manager;
@@ -14,6 +16,26 @@ struct TestWorker: Worker {
     void fetch_state () override { }
     void terminate   () override { if (term_cb) term_cb(); }
     void kill        () override { if (kill_cb) kill_cb(); }
+    void activate    () override { ++activated; }
+
+    int activated = 0;
+};
+
+struct FixedPolicy : ScalingPolicy {
+    int32_t decision;
+    FixedPolicy (int32_t decision) : decision(decision) {}
+    int32_t decide (const Config&, const Stats&) override { return decision; }
+};
+
+// checks in tests run faster than a millisecond or not, fixed interval makes pid output independent of it
+struct FixedIntervalPidPolicy : PidScalingPolicy {
+    float interval;
+    FixedIntervalPidPolicy (float interval) : interval(interval) {}
+    int32_t decide (const Config& config, const Stats& st) override {
+        auto fixed = st;
+        fixed.interval = interval;
+        return PidScalingPolicy::decide(config, fixed);
+    }
 };
 
 struct TestMpm: Mpm {
@@ -25,7 +47,7 @@ struct TestMpm: Mpm {
         Mpm::run();
     }
 
-    WorkerPtr create_worker () override { return std::make_unique<TestWorker>(); }
+    WorkerPtr create_worker (const WorkerParams&) override { return std::make_unique<TestWorker>(); }
     void terminate_worker(WorkerPtr& it) { worker_terminated(it.get()); }
 
     void auto_stop_loop() {
@@ -46,8 +68,18 @@ struct TestMpm: Mpm {
     bool is_state_stopping() { return state == State::stopping; }
     bool is_state_stopped()  { return state == State::stopped;  }
 
+    void notify()            { notified(); }
+
+    void set_scaling_policy(ScalingPolicyPtr p) { scaling_policy = std::move(p); }
+    void set_state(Worker* w, Worker::State state) { Mpm::set_state(w, state); }
+
+    template <class F>
+    void for_each(int states, F&& fn) { for_each_worker(states, std::forward<F>(fn)); }
+
     auto& get_check_timer()  { return check_timer; }
+    auto& get_notify_timer() { return notify_timer; }
     auto& get_workers()      { return workers;     }
+    auto& get_listen_slots() { return listen_slots; }
 };
 
 TEST_CASE("mpm", "[mpm]") {
@@ -61,10 +93,17 @@ TEST_CASE("mpm", "[mpm]") {
         CHECK(mpm.is_state_initial());
 
         int started = 0;
+        int preloaded = 0;
+        mpm.preload_event.add([&](auto...){
+            CHECK(started == 0);
+            CHECK(mpm.get_workers().empty());
+            ++preloaded;
+        });
         mpm.start_event.add([&](auto...){ ++started; });
         mpm.run();
         CHECK(mpm.is_state_running());
         CHECK(started == 1);
+        CHECK(preloaded == 1);
         auto& workers = mpm.get_workers();
         CHECK(workers.size() == 2);
     }
@@ -85,6 +124,42 @@ TEST_CASE("mpm", "[mpm]") {
         CHECK(workers.size() == 0);
     }
 
+    SECTION("per-state worker lists") {
+        cfg.min_servers = 3;
+        cfg.max_servers = 3;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+        auto& workers = mpm.get_workers();
+        REQUIRE(mpm.count_workers(Worker::State::starting) == 3);
+
+        int visited = 0;
+        mpm.for_each((int)Worker::State::starting | (int)Worker::State::running, [&](Worker* w) {
+            ++visited;
+            mpm.set_state(w, Worker::State::running); // moved to a list being iterated, but not visited again
+        });
+        CHECK(visited == 3);
+        CHECK(mpm.count_workers(Worker::State::starting) == 0);
+        CHECK(mpm.count_workers(Worker::State::running) == 3);
+
+        visited = 0;
+        mpm.for_each((int)Worker::State::running | (int)Worker::State::terminating, [&](Worker* w) {
+            ++visited;
+            mpm.set_state(w, Worker::State::terminating); // the list was empty when called
+        });
+        CHECK(visited == 3);
+        CHECK(mpm.count_workers(Worker::State::running) == 0);
+        CHECK(mpm.count_workers(Worker::State::terminating) == 3);
+
+        mpm.terminate_worker(workers.begin()->second); // unlinked, check spawns 3 instead of terminating ones
+        CHECK(workers.size() == 5);
+        CHECK(mpm.count_workers(Worker::State::terminating) == 2);
+        CHECK(mpm.count_workers(Worker::State::starting) == 3);
+
+        visited = 0;
+        mpm.for_each((int)Worker::State::terminating, [&](Worker*) { ++visited; });
+        CHECK(visited == 2);
+    }
+
     SECTION("kill inactive workers") {
         cfg.max_servers = 1;
         cfg.activity_timeout = 1;
@@ -95,13 +170,34 @@ TEST_CASE("mpm", "[mpm]") {
         auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
         w->kill_cb = [&](){ killed = true; };
         w->activity_time = 0;
-        w->state = Worker::State::running;
+        mpm.set_state(w, Worker::State::running);
         mpm.get_check_timer()->call_now();
 
         CHECK(killed);
         CHECK(mpm.get_workers().size() > 0);
     }
 
+    SECTION("kill not responding workers with sub-second timeout") {
+        cfg.max_servers      = 1;
+        cfg.check_interval   = 0.1;
+        cfg.activity_timeout = 0.3;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+
+        bool killed = false;
+        auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
+        w->kill_cb = [&](){ killed = true; };
+        mpm.set_state(w, Worker::State::running);
+
+        w->activity_time = monotonic_ms() - 100;
+        mpm.get_check_timer()->call_now();
+        CHECK(!killed);
+
+        w->activity_time = monotonic_ms() - 500;
+        mpm.get_check_timer()->call_now();
+        CHECK(killed);
+    }
+
     SECTION("autorestart workers") {
         cfg.max_servers = 1;
         cfg.max_requests = 1;
@@ -111,7 +207,7 @@ TEST_CASE("mpm", "[mpm]") {
         auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
         w->total_requests = 2;
         w->creation_time = 0;
-        w->state = Worker::State::running;
+        mpm.set_state(w, Worker::State::running);
         mpm.get_check_timer()->call_now();
 
         CHECK(mpm.get_workers().size() == 2);
@@ -136,7 +232,7 @@ TEST_CASE("mpm", "[mpm]") {
         auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
         w->load_average = 1;
 
-        w->state = Worker::State::running;
+        mpm.set_state(w, Worker::State::running);
         mpm.get_check_timer()->call_now();
 
         CHECK(mpm.get_workers().size() == 4);
@@ -145,7 +241,7 @@ TEST_CASE("mpm", "[mpm]") {
         SECTION("back to min") {
             for(auto& it: mpm.get_workers()) {
                 auto w = static_cast<TestWorker*>(it.second.get());
-                w->state = Worker::State::running;
+                mpm.set_state(w, Worker::State::running);
                 w->load_average = 0;
                 w->creation_time = 0; // to terminate;
                 w->term_cb = [&](){ ++terminated; };
@@ -155,6 +251,457 @@ TEST_CASE("mpm", "[mpm]") {
         }
     }
 
+    SECTION("max_servers is a hard limit for policy") {
+        cfg.min_servers = 3;
+        cfg.max_servers = 3;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+        auto& workers = mpm.get_workers();
+        REQUIRE(workers.size() == 3);
+
+        int terminated = 0;
+        for (auto& it : workers) {
+            auto w = static_cast<TestWorker*>(it.second.get());
+            mpm.set_state(w, Worker::State::running);
+            w->creation_time = 0;
+            w->term_cb = [&](){ ++terminated; };
+        }
+        mpm.set_scaling_policy(std::make_unique<FixedPolicy>(3));
+
+        auto cfg2 = mpm.get_config();
+        cfg2.min_servers = 1;
+        cfg2.max_servers = 1;
+        mpm.reconfigure(cfg2);
+        mpm.auto_stop_loop();
+        loop->run();
+
+        CHECK(workers.size() == 3); // nothing spawned above max_servers
+        CHECK(terminated == 2);
+    }
+
+    SECTION("connection capacity") {
+        // to hold 20 connections + 5 spare: round_up(25/10) = 3 workers
+        cfg.max_servers = 5;
+        cfg.max_connections_per_worker = 10;
+        cfg.min_spare_connections = 5;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+        REQUIRE(mpm.get_workers().size() == 1);
+
+        auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
+        w->connections = 20;
+        mpm.set_state(w, Worker::State::running);
+        mpm.get_check_timer()->call_now();
+
+        CHECK(mpm.get_workers().size() == 3);
+        CHECK(mpm.get_last_stats().connections == 20);
+
+        int terminated = 0;
+        for (auto& it : mpm.get_workers()) {
+            auto w = static_cast<TestWorker*>(it.second.get());
+            mpm.set_state(w, Worker::State::running);
+            w->connections = 8;
+            w->creation_time = 0;
+            w->term_cb = [&](){ ++terminated; };
+        }
+        mpm.get_check_timer()->call_now();
+        CHECK(terminated == 0); // idle by load, but needed for connections
+    }
+
+    SECTION("latency target") {
+        cfg.max_servers = 5;
+        cfg.target_p99_latency = 10;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+        REQUIRE(mpm.get_workers().size() == 1);
+
+        auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
+        for (int i = 0; i < 100; ++i) w->latency.record(50000);
+        mpm.set_state(w, Worker::State::running);
+        mpm.get_check_timer()->call_now();
+
+        CHECK(mpm.get_workers().size() == 2); // at most doubling per check
+        CHECK(mpm.get_last_stats().p99_latency > 10);
+
+        int terminated = 0;
+        for (auto& it : mpm.get_workers()) {
+            auto w = static_cast<TestWorker*>(it.second.get());
+            mpm.set_state(w, Worker::State::running);
+            w->latency.clear();
+            w->creation_time = 0;
+            w->term_cb = [&](){ ++terminated; };
+        }
+        mpm.get_check_timer()->call_now();
+        CHECK(terminated == 0); // idle by load, but latency_cooldown has not passed
+    }
+
+    SECTION("latency target keeps the last worker") {
+        cfg.min_servers = 0;
+        cfg.target_p99_latency = 10;
+        cfg.latency_cooldown = 0;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.set_scaling_policy(std::make_unique<FixedPolicy>(1));
+        mpm.run();
+        auto& workers = mpm.get_workers();
+        REQUIRE(workers.size() == 1);
+        mpm.set_scaling_policy(std::make_unique<FixedPolicy>(0));
+
+        int terminated = 0;
+        auto w = static_cast<TestWorker*>(workers.begin()->second.get());
+        mpm.set_state(w, Worker::State::running);
+        w->creation_time = 0;
+        w->term_cb = [&](){ ++terminated; };
+        mpm.get_check_timer()->call_now();
+        mpm.get_check_timer()->call_now();
+        CHECK(terminated == 0); // nobody would take its load
+    }
+
+    SECTION("loop lag") {
+        cfg.max_servers = 5;
+        cfg.lag_probe_interval = 10;
+        cfg.max_loop_lag = 50;
+        cfg.loop_stall_timeout = 0.5;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+        REQUIRE(mpm.get_workers().size() == 1);
+
+        auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
+        mpm.set_state(w, Worker::State::running);
+        w->probe_time = monotonic_ms();
+        w->loop_lag_p99 = 200000;
+        mpm.get_check_timer()->call_now();
+
+        CHECK(mpm.get_workers().size() == 2);
+        CHECK(mpm.get_last_stats().loop_lag == 200);
+
+        bool killed = false;
+        w->kill_cb = [&](){ killed = true; };
+        mpm.get_check_timer()->call_now();
+        CHECK(!killed);
+        CHECK(mpm.get_workers().size() == 2); // still lagging, but spawned workers need time to take load
+
+        w->probe_time = monotonic_ms() - 1000;
+        mpm.get_check_timer()->call_now();
+        CHECK(killed);
+    }
+
+    SECTION("victim selection") {
+        cfg.min_servers = 2;
+        cfg.max_servers = 3;
+        cfg.max_load    = 0.5;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+        auto& workers = mpm.get_workers();
+        for (auto& it : workers) {
+            mpm.set_state(it.second.get(), Worker::State::running);
+            it.second->load_average = 1;
+        }
+        mpm.get_check_timer()->call_now();
+        REQUIRE(workers.size() == 3);
+
+        std::vector<TestWorker*> ws;
+        for (auto& it : workers) {
+            auto w = static_cast<TestWorker*>(it.second.get());
+            mpm.set_state(w, Worker::State::running);
+            w->creation_time = 0;
+            ws.push_back(w);
+        }
+        ws[0]->active_requests = 5; ws[0]->load_average = 0.1;  ws[0]->total_requests = 10;
+        ws[1]->active_requests = 0; ws[1]->load_average = 0.2;  ws[1]->total_requests = 100;
+        ws[2]->active_requests = 0; ws[2]->load_average = 0.05; ws[2]->total_requests = 1;
+
+        SECTION("drain cost") {
+            mpm.get_check_timer()->call_now();
+            CHECK(ws[0]->state == Worker::State::running);
+            CHECK(ws[1]->state == Worker::State::running);
+            CHECK(ws[2]->state == Worker::State::terminating);
+        }
+
+        SECTION("open connections") {
+            ws[2]->connections = 10;
+            mpm.get_check_timer()->call_now();
+            CHECK(ws[1]->state == Worker::State::terminating);
+            CHECK(ws[2]->state == Worker::State::running);
+        }
+
+        SECTION("most requests") {
+            auto cfg2 = mpm.get_config();
+            cfg2.victim_selection = Manager::VictimSelection::MostRequests;
+            mpm.reconfigure(cfg2);
+            mpm.auto_stop_loop();
+            loop->run();
+            CHECK(ws[0]->state == Worker::State::running);
+            CHECK(ws[1]->state == Worker::State::terminating);
+            CHECK(ws[2]->state == Worker::State::running);
+        }
+    }
+
+    SECTION("pid scaling policy") {
+        cfg.max_servers   = 8;
+        cfg.scaling_model = Manager::ScalingModel::Pid;
+        cfg.target_load   = 0.5;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.set_scaling_policy(std::make_unique<FixedIntervalPidPolicy>(1));
+        mpm.run();
+        REQUIRE(mpm.get_workers().size() == 1);
+
+        auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
+        w->load_average = 1;
+        mpm.set_state(w, Worker::State::running);
+        mpm.get_check_timer()->call_now();
+
+        CHECK(mpm.get_workers().size() == 3); // error 1: proportional 1 + integral 0.2 over one second -> 2 more
+
+        SECTION("scales down when idle") {
+            int terminated = 0;
+            for (auto& it: mpm.get_workers()) {
+                auto w = static_cast<TestWorker*>(it.second.get());
+                mpm.set_state(w, Worker::State::running);
+                w->load_average = 0;
+                w->creation_time = 0;
+                w->term_cb = [&](){ ++terminated; };
+            }
+            for (int i = 0; i < 20 && !terminated; ++i) mpm.get_check_timer()->call_now();
+            CHECK(terminated > 0);
+        }
+    }
+
+    SECTION("worker notification triggers check") {
+        cfg.max_servers     = 4;
+        cfg.notify_interval = 60000; // long enough to never pass during the test
+        TestMpm mpm(cfg, loop, loop);
+        int checks = 0;
+        mpm.stats_event.add([&](auto&) { ++checks; });
+        mpm.run();
+        REQUIRE(mpm.get_workers().size() == 1);
+        REQUIRE(checks == 1);
+
+        auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
+        w->load_average = 1;
+        mpm.set_state(w, Worker::State::running);
+
+        // rate-limited: a burst of notifications right after a check is coalesced into one delayed check
+        mpm.notify();
+        mpm.notify();
+        CHECK(checks == 1);
+        CHECK(mpm.get_workers().size() == 1);
+
+        mpm.get_notify_timer()->call_now();
+        CHECK(checks == 2);
+        CHECK(mpm.get_workers().size() > 1);
+    }
+
+    SECTION("autorestart workers by memory") {
+        cfg.max_servers    = 1;
+        cfg.max_worker_rss = 100 << 20;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+
+        auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
+        mpm.set_state(w, Worker::State::running);
+        w->memory = 50 << 20;
+        mpm.get_check_timer()->call_now();
+        CHECK(w->state == Worker::State::running);
+
+        w->memory = 200 << 20;
+        mpm.get_check_timer()->call_now();
+        CHECK(w->state == Worker::State::running); // min_worker_ttl
+
+        w->creation_time = 0;
+        mpm.get_check_timer()->call_now();
+        CHECK(w->state == Worker::State::restarting);
+    }
+
+    SECTION("rolling restart") {
+        cfg.min_servers = 3;
+        cfg.max_servers = 3;
+        cfg.max_surge   = 1;
+        TestMpm mpm(cfg, loop, loop);
+        std::vector<std::pair<uint32_t, uint32_t>> progress;
+        mpm.restart_event.add([&](auto replaced, auto total) { progress.push_back({replaced, total}); });
+        mpm.run();
+
+        auto& workers = mpm.get_workers();
+        for (auto& it : workers) mpm.set_state(it.second.get(), Worker::State::running);
+
+        mpm.restart_workers();
+        mpm.auto_stop_loop();
+        loop->run();
+
+        auto count = [&](Worker::State state) {
+            size_t ret = 0;
+            for (auto& it : workers) if (it.second->state == state) ++ret;
+            return ret;
+        };
+        CHECK(workers.size() == 4);
+        CHECK(count(Worker::State::restarting) == 1);
+        CHECK(count(Worker::State::starting) == 1);
+        CHECK(progress.empty());
+
+        for (int i = 1; i <= 3; ++i) {
+            for (auto& it : workers) {
+                if (it.second->state == Worker::State::starting) mpm.set_state(it.second.get(), Worker::State::running);
+            }
+            mpm.get_check_timer()->call_now();
+            REQUIRE(progress.size() == (size_t)i);
+            CHECK(progress.back().first == (uint32_t)i);
+            CHECK(progress.back().second == 3);
+            CHECK(count(Worker::State::restarting) == (i < 3 ? 1 : 0));
+        }
+    }
+
+    SECTION("stats snapshot and stats_event") {
+        cfg.min_servers = 2;
+        TestMpm mpm(cfg, loop, loop);
+        int checks = 0;
+        uint32_t total = 0;
+        mpm.stats_event.add([&](auto& st) {
+            ++checks;
+            total = st.total;
+            CHECK(mpm.get_workers().size() == 2); // fired after spawning
+        });
+        mpm.run();
+        CHECK(checks == 1);
+
+        mpm.get_check_timer()->call_now();
+        CHECK(checks == 2);
+        CHECK(total == 2);
+
+        auto st = mpm.stats();
+        CHECK(st.last_check.total == 2);
+        CHECK(st.counters.spawned == 2);
+        REQUIRE(st.workers.size() == 2);
+        CHECK(st.workers[0].state == Worker::State::starting);
+        CHECK(st.workers[0].spawn_time > 0);
+    }
+
+    SECTION("standby workers") {
+        cfg.max_servers     = 4;
+        cfg.max_load        = 0.5;
+        cfg.standby_servers = 2;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+
+        auto& workers = mpm.get_workers();
+        std::vector<TestWorker*> standby;
+        for (auto& it : workers) {
+            auto w = static_cast<TestWorker*>(it.second.get());
+            if (w->state == Worker::State::standby) standby.push_back(w);
+            else mpm.set_state(w, Worker::State::running);
+        }
+        REQUIRE(workers.size() == 3);
+        REQUIRE(standby.size() == 2);
+        std::sort(standby.begin(), standby.end(), [](auto a, auto b) { return a->id < b->id; }); // workers map is unordered
+
+        SECTION("activated instead of spawning") {
+            for (auto w : standby) w->activity_time = 1; // initialized
+            for (auto& it : workers) if (it.second->state == Worker::State::running) it.second->load_average = 1;
+            mpm.get_check_timer()->call_now();
+
+            // load 1 / 0.5 -> one more worker needed, the oldest standby is taken; standby refilled only up to max_servers
+            CHECK(standby[0]->activated == 1);
+            CHECK(standby[0]->state == Worker::State::running);
+            CHECK(standby[1]->activated == 0);
+            CHECK(workers.size() == 4);
+        }
+
+        SECTION("not activated until initialized") {
+            for (auto& it : workers) if (it.second->state == Worker::State::running) it.second->load_average = 1;
+            mpm.get_check_timer()->call_now();
+            CHECK(standby[0]->activated == 0);
+            CHECK(standby[1]->activated == 0);
+        }
+    }
+
+    SECTION("affinity placement slots are reused") {
+        cfg.min_servers = 3;
+        cfg.max_servers = 3;
+        cfg.affinity    = Manager::Affinity::Core;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+
+        auto& workers = mpm.get_workers();
+        REQUIRE(workers.size() == 3);
+        std::vector<int32_t> slots;
+        for (auto& it : workers) slots.push_back(it.second->placement_slot);
+        std::sort(slots.begin(), slots.end());
+        CHECK(slots == std::vector<int32_t>{0, 1, 2});
+
+        auto it = workers.begin();
+        auto freed = it->second->placement_slot;
+        mpm.terminate_worker(it->second); // check_workers spawns replacement
+        REQUIRE(workers.size() == 3);
+        uint64_t newest = 0;
+        for (auto& row : workers) newest = std::max(newest, row.first);
+        CHECK(workers.at(newest)->placement_slot == freed);
+
+        // replacement of restarted worker takes over its cpu
+        mpm.restart_workers();
+        mpm.auto_stop_loop();
+        loop->run();
+        int restarting = 0;
+        for (auto& row : workers) {
+            auto w = row.second.get();
+            if (w->state != Worker::State::restarting) continue;
+            ++restarting;
+            CHECK(workers.at(w->replaced_by)->placement_slot == w->placement_slot);
+        }
+        CHECK(restarting == 3);
+    }
+
+    SECTION("per-worker sockets") {
+        cfg.server.locations[0].reuse_port = true;
+        cfg.per_worker_sockets = true;
+        cfg.min_servers = 2;
+        cfg.max_servers = 2;
+        cfg.max_surge   = 1;
+        TestMpm mpm(cfg, loop, loop);
+        mpm.run();
+
+        auto& workers = mpm.get_workers();
+        auto& slots   = mpm.get_listen_slots();
+        REQUIRE(workers.size() == 2);
+        REQUIRE(slots.size() == 2);
+        for (auto& it : workers) {
+            mpm.set_state(it.second.get(), Worker::State::running);
+            CHECK(slots.at(it.second->listen_slot).socks.size() == 1);
+        }
+
+        mpm.restart_workers();
+        mpm.auto_stop_loop();
+        loop->run();
+
+        Worker* old = nullptr;
+        for (auto& it : workers) if (it.second->state == Worker::State::restarting) old = it.second.get();
+        REQUIRE(old);
+        auto replacement = workers.at(old->replaced_by).get();
+        auto slot = old->listen_slot;
+        CHECK(replacement->listen_slot == slot); // takes over the queue of the worker it replaces
+        CHECK(slots[slot].users == 2);
+
+        mpm.set_state(replacement, Worker::State::running);
+        mpm.get_check_timer()->call_now();
+        CHECK(old->state == Worker::State::terminating);
+        CHECK(slots[slot].users == 1);
+        CHECK(slots[slot].socks.size() == 1);
+        CHECK(slots.size() == 2);
+    }
+
+    SECTION("accept mutex is prefork only") {
+        cfg.accept_mutex = true;
+        cfg.worker_model = Manager::WorkerModel::Thread;
+        CHECK_THROWS(TestMpm(cfg, loop, loop));
+        cfg.worker_model = Manager::WorkerModel::PreFork;
+        TestMpm mpm(cfg, loop, loop);
+        CHECK(mpm.get_config().accept_max_load == 0.7f);
+
+        cfg.server.locations = { {"127.0.0.1", 0} };
+        cfg.server.locations[0].reuse_port = true;
+        CHECK_THROWS(TestMpm(cfg, loop, loop)); // workers would drop connections queued on their own sockets
+        cfg.per_worker_sockets = true;
+        CHECK_NOTHROW(TestMpm(cfg, loop, loop));
+    }
+
     SECTION("reconfigure") {
         TestMpm mpm(cfg, loop, loop);
         cfg.check_interval = 1;
@@ -163,7 +710,7 @@ TEST_CASE("mpm", "[mpm]") {
         CHECK(workers.size() == 1);
 
         auto w1 = static_cast<TestWorker*>(workers.begin()->second.get());
-        w1->state = Worker::State::running;
+        mpm.set_state(w1, Worker::State::running);
 
         auto cfg2 = cfg;
         cfg2.check_interval = 2;
@@ -188,3 +735,47 @@ TEST_CASE("mpm", "[mpm]") {
     }
 
 }
+
+TEST_CASE("metrics", "[mpm]") {
+    auto loop = panda::unievent::Loop::default_loop();
+    auto cfg = Mpm::Config{};
+    cfg.server.locations = { {"127.0.0.1", 0} };
+    cfg.min_servers = 2;
+    TestMpm mpm(cfg, loop, loop);
+    mpm.run();
+
+    auto w = static_cast<TestWorker*>(mpm.get_workers().begin()->second.get());
+    w->total_requests = 42;
+
+    MetricsServer metrics(mpm, loop);
+    auto text = metrics.render();
+    CHECK(text.find("unievent_http_manager_workers{state=\"starting\"} 2\n") != string::npos);
+    CHECK(text.find("unievent_http_manager_spawns_total 2\n") != string::npos);
+    CHECK(text.find("unievent_http_manager_worker_requests_total{worker=\"" + panda::to_string(w->id) + "\"} 42\n") != string::npos);
+    CHECK(text.substr(text.length() - 6) == "# EOF\n");
+}
+
+TEST_CASE("latency histogram", "[mpm]") {
+    Histogram::Shared shared;
+    shared.reset();
+    uint32_t seen[Histogram::buckets_count] = {};
+    for (int i = 1; i <= 1000; ++i) shared.record(i * 100);
+
+    Histogram h;
+    h.fetch(shared, seen);
+    CHECK(h.count == 1000);
+    CHECK(h.percentile(0.5) >= 50000);
+    CHECK(h.percentile(0.5) < 50000 * 1.13);
+    CHECK(h.percentile(0.99) >= 99000);
+
+    h.fetch(shared, seen);
+    CHECK(h.count == 0);
+    CHECK(h.percentile(0.99) == 0);
+
+    shared.record(3);
+    Histogram h2;
+    h2.fetch(shared, seen);
+    h.merge(h2);
+    CHECK(h.count == 1);
+    CHECK(h.percentile(0.5) == 4);
+}
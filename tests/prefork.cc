@@ -0,0 +1,144 @@
+#ifndef _WIN32
+#include <catch2/catch_test_macros.hpp>
+#include <panda/unievent/http/manager/PreFork.h>
+#include <panda/unievent/util.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace panda;
+using namespace panda::unievent::http::manager;
+
+namespace {
+    struct StubWorker : Worker {
+        void fetch_state () override {}
+        void terminate   () override {}
+        void kill        () override {}
+        void activate    () override {}
+    };
+
+    struct StubMpm : Mpm {
+        using Mpm::Mpm;
+        WorkerPtr create_worker (const WorkerParams&) override { return std::make_unique<StubWorker>(); }
+        void bind () {
+            auto res = create_and_bind_sockets(config);
+            REQUIRE(res);
+        }
+    };
+}
+
+TEST_CASE("hybrid", "[prefork]") {
+    auto loop = panda::unievent::Loop::default_loop();
+    auto cfg = Mpm::Config{};
+    cfg.server.locations = { {"127.0.0.1", 0} };
+    cfg.worker_model = Manager::WorkerModel::Hybrid;
+    cfg.max_servers  = 2;
+
+    SECTION("config normalization") {
+        StubMpm mpm(cfg, loop, loop);
+        CHECK(mpm.get_config().threads_per_worker >= 1);
+
+        cfg.threads_per_worker = 3;
+        StubMpm mpm2(cfg, loop, loop);
+        CHECK(mpm2.get_config().threads_per_worker == 3);
+    }
+
+    SECTION("unsupported options are rejected") {
+        auto cfg2 = cfg;
+        cfg2.standby_servers = 1;
+        CHECK_THROWS(StubMpm(cfg2, loop, loop));
+
+        cfg2 = cfg;
+        cfg2.accept_mutex = true;
+        CHECK_THROWS(StubMpm(cfg2, loop, loop));
+    }
+
+    SECTION("worker process keeps master's unix socket") {
+        auto res = panda::unievent::socket(AF_UNIX, SOCK_STREAM, 0);
+        REQUIRE(res);
+        panda::unievent::http::Server::Location loc;
+        loc.path = "/tmp/unievent-http-manager-test.sock";
+        loc.sock = res.value();
+        cfg.server.locations = { loc };
+
+        StubMpm mpm(cfg, loop, loop);
+        mpm.bind();
+        CHECK(mpm.get_config().server.locations[0].sock.value() == res.value());
+        close(res.value());
+    }
+
+    SECTION("stats of threads are aggregated") {
+        Workers threads;
+        for (uint64_t i = 1; i <= 3; ++i) {
+            auto w = std::make_unique<StubWorker>();
+            w->active_requests = i;
+            w->recent_requests = 10 * i;
+            w->connections     = 100 * i;
+            w->loop_lag_max    = 1000 * i;
+            w->loop_lag_p99    = 4000 - 1000 * i;
+            threads[i] = std::move(w);
+        }
+        auto totals = ThreadTotals::sum(threads);
+        CHECK(totals.active_requests == 6);
+        CHECK(totals.recent_requests == 60);
+        CHECK(totals.connections == 600);
+        CHECK(totals.loop_lag_max == 3000);
+        CHECK(totals.loop_lag_p99 == 3000);
+
+        CHECK(ThreadTotals::sum({}).active_requests == 0);
+    }
+}
+
+TEST_CASE("accept mutex", "[prefork]") {
+    SECTION("one holder at a time") {
+        AcceptMutex mutex;
+        CHECK(mutex.take(100));
+        CHECK(!mutex.take(200));
+        CHECK(!mutex.release(200)); // not a holder
+        CHECK(mutex.holder == 100);
+        CHECK(mutex.release(100));
+        CHECK(mutex.holder == 0);
+        CHECK(mutex.take(200));
+    }
+
+    SECTION("reaped holder frees the turn") {
+        AcceptMutex mutex;
+        CHECK(mutex.take(100));
+        mutex.release(100); // as handle_sigchld does for a reaped pid
+        CHECK(mutex.take(200));
+        CHECK(!mutex.release(100)); // reaping a non-holder keeps the turn
+        CHECK(mutex.holder == 200);
+    }
+
+    SECTION("turn follows load") {
+        AcceptTurn turn;
+        turn.max_load = 0.7;
+        CHECK(turn.tick(0.1) == AcceptTurn::Action::Take);
+        turn.held = true;
+        CHECK(turn.tick(0.5) == AcceptTurn::Action::None); // holder keeps its turn
+        CHECK(turn.tick(0.8) == AcceptTurn::Action::Release);
+        turn.held = false;
+        CHECK(turn.tick(0.1) == AcceptTurn::Action::None); // sits out one tick, so that others can take the turn
+        CHECK(turn.tick(0.1) == AcceptTurn::Action::Take);
+
+        AcceptTurn loaded;
+        loaded.max_load = 0.7;
+        int takes = 0;
+        for (int i = 0; i < 16; ++i) if (loaded.tick(0.9) == AcceptTurn::Action::Take) ++takes;
+        CHECK(takes == 2); // loaded worker still competes, every 8th time
+    }
+
+    SECTION("turn is held for a bounded time") {
+        AcceptTurn turn;
+        turn.max_load = 0.7;
+        CHECK(turn.tick(0.1) == AcceptTurn::Action::Take);
+        turn.held = true;
+        uint32_t kept = 0;
+        while (turn.tick(0.1) == AcceptTurn::Action::None) ++kept; // idle worker would otherwise take every connection
+        CHECK(kept == AcceptTurn::max_hold - 1);
+        turn.held = false;
+        CHECK(turn.tick(0.1) == AcceptTurn::Action::None);
+        CHECK(turn.tick(0.1) == AcceptTurn::Action::Take);
+    }
+}
+
+#endif